@@ -1,6 +1,22 @@
+# Target CPU: i386 (default) or i686 (Pentium Pro instructions for the whole system,
+# and SSE2 code generation for user space, see USER_ARCH_FLAGS).
+# The kernel and the common code are never compiled with SSE enabled: the kernel only
+# uses the SSE registers explicitly (see kernel/fpu.h), and the common objects are linked
+# into the kernel as well.
+ARCH?=i386
+ifeq ($(ARCH),i686)
+ARCH_FLAGS=-march=i686 -mtune=generic
+USER_ARCH_FLAGS=-msse2 -mfpmath=sse
+else ifeq ($(ARCH),i386)
+ARCH_FLAGS=-march=i386
+USER_ARCH_FLAGS=
+else
+$(error invalid ARCH)
+endif
+
 LD=gcc
-BAREMETAL_FLAGS=-m32 -march=i386 -ffreestanding -nostdlib -fno-builtin -fno-stack-protector -fno-pie -static
-CC=gcc -std=gnu11 $(BAREMETAL_FLAGS) -Wall -Wextra -MMD -c -march=i386
+BAREMETAL_FLAGS=-m32 $(ARCH_FLAGS) -ffreestanding -nostdlib -fno-builtin -fno-stack-protector -fno-pie -static
+CC=gcc -std=gnu11 $(BAREMETAL_FLAGS) -Wall -Wextra -MMD -c
 
 COMMON_DIR=../common
 COMMON_C=$(shell find $(COMMON_DIR) -iname "*.c")
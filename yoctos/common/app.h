@@ -0,0 +1,18 @@
+#ifndef _APP_COMMON_H_
+#define _APP_COMMON_H_
+
+#include "types.h"
+
+// Header located at the start of every application binary (see user/entrypoint_asm.s).
+// The code and read-only data come first and the data starts on a page boundary (see
+// user/app.ld), so that the kernel can map the pages of the module loaded by GRUB into
+// the task instead of copying them: read-only up to ro_end, copy-on-write afterwards.
+#define APP_MAGIC  0x50504159  // "YAPP"
+
+typedef struct {
+    uint8_t jmp[4];      // jump over the header to the entry point
+    uint32_t magic;      // APP_MAGIC
+    uint32_t ro_end;     // end of the read-only part (virtual address aligned to 4KB)
+} app_header_t;
+
+#endif
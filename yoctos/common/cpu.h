@@ -0,0 +1,61 @@
+#ifndef _CPU_COMMON_H_
+#define _CPU_COMMON_H_
+
+#include "types.h"
+
+// CPUID leaf 1 feature flags (edx)
+#define CPUID_EDX_PSE   (1 << 3)   // page size extensions (4MB pages)
+#define CPUID_EDX_TSC   (1 << 4)
+#define CPUID_EDX_MSR   (1 << 5)
+#define CPUID_EDX_SEP   (1 << 11)  // SYSENTER/SYSEXIT
+#define CPUID_EDX_PGE   (1 << 13)  // global pages
+#define CPUID_EDX_FXSR  (1 << 24)  // FXSAVE/FXRSTOR
+#define CPUID_EDX_SSE   (1 << 25)
+#define CPUID_EDX_SSE2  (1 << 26)
+
+// Executes the cpuid instruction for the specified leaf.
+static inline void cpuid(uint32_t leaf, uint32_t *eax, uint32_t *ebx, uint32_t *ecx, uint32_t *edx) {
+    asm volatile("cpuid" : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx) : "a"(leaf), "c"(0));
+}
+
+// Returns true if the CPU supports the SYSENTER/SYSEXIT instructions.
+// Early Pentium Pro (family 6, model < 3, stepping < 3) report SEP without supporting it.
+static inline bool cpu_has_sysenter() {
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    if (!(edx & CPUID_EDX_SEP))
+        return false;
+    uint_t family = (eax >> 8) & 0xf, model = (eax >> 4) & 0xf, stepping = eax & 0xf;
+    return !(family == 6 && model < 3 && stepping < 3);
+}
+
+// Returns true if the CPU supports 4MB pages.
+static inline bool cpu_has_pse() {
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    return edx & CPUID_EDX_PSE;
+}
+
+// Returns true if the CPU supports global pages.
+static inline bool cpu_has_pge() {
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    return edx & CPUID_EDX_PGE;
+}
+
+// Returns true if the CPU supports SSE2 (and the FXSAVE/FXRSTOR instructions needed to enable it).
+static inline bool cpu_has_sse2() {
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    return (edx & (CPUID_EDX_FXSR | CPUID_EDX_SSE | CPUID_EDX_SSE2)) == (CPUID_EDX_FXSR | CPUID_EDX_SSE | CPUID_EDX_SSE2);
+}
+
+// Returns the number of CPU cycles elapsed since reset (time-stamp counter).
+// Available in both kernel and user mode (CR4.TSD is never set).
+static inline uint64_t rdtsc() {
+    uint64_t tsc;
+    asm volatile("rdtsc" : "=A"(tsc));
+    return tsc;
+}
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef _KBENCH_COMMON_H_
+#define _KBENCH_COMMON_H_
+
+#include "types.h"
+
+// Kernel micro-benchmarks that can be run from user space with the kbench syscall.
+enum kbench_t {
+    KBENCH_TASK_SWITCH = 0,
+    KBENCH_TASK_LOAD,
+    KBENCH_FRAMES,
+    KBENCH_COW,
+    KBENCH_COUNT  // must always be last
+};
+
+// Results of KBENCH_TASK_SWITCH, in CPU cycles per switch.
+typedef struct {
+    uint32_t hw_switch;      // hardware task switch (far call to a TSS selector)
+    uint32_t sw_switch;      // software context switch, same address space
+    uint32_t sw_switch_cr3;  // software context switch with a CR3 reload
+} kbench_switch_t;
+
+// Parameters and results of KBENCH_TASK_LOAD, in CPU cycles per load (and free) of
+// the application name.
+typedef struct {
+    char name[32];           // application to load (set by the caller)
+    uint32_t map;            // module pages mapped into the task (read-only/copy-on-write)
+    uint32_t copy;           // module copied into the task
+    uint32_t shared_pages;   // pages of the module mapped instead of copied
+} kbench_load_t;
+
+// Results of KBENCH_FRAMES, in CPU cycles per allocation and free of a block
+// (including zeroing the frames).
+typedef struct {
+    uint32_t single;         // single frame, freed right away
+    uint32_t mixed;          // blocks of 1 to 16 frames, kept and freed in random order
+    uint32_t failures;       // allocations that failed in the mixed run
+    uint32_t largest_free_order;  // order of the largest free block after the mixed run
+} kbench_frames_t;
+
+// Results of KBENCH_COW, in CPU cycles per page, for pages shared copy-on-write between
+// two page directories then written into from both sides.
+typedef struct {
+    uint32_t share;          // page shared (reference count incremented, made read-only)
+    uint32_t copy;           // first write: the page is remapped to a private copy of the frame
+    uint32_t reuse;          // write by the last reference: the frame becomes writable again
+    uint32_t errors;         // pages with a wrong content or reference count (0 expected)
+} kbench_cow_t;
+
+#endif
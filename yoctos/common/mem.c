@@ -1,28 +1,251 @@
 #include <stdint.h>
 #include "mem.h"
 
-void memset(void *dst, uint8_t value, uint_t count) {
-    uint8_t *d = dst;
+// Copies/fills of at least this many bytes use the large block implementation
+// (SSE2 if enabled by mem_init).
+#define LARGE_MIN 256
+
+// Copies/fills of at least this many bytes bypass the caches with non-temporal
+// stores: the data would evict everything else from the cache anyway.
+#define NON_TEMPORAL_MIN (2*1024*1024)
+
+// The SSE registers used below only have to be declared as clobbered when the
+// compiler itself may use them (e.g. host build of the benchmark).
+#ifdef __SSE__
+#define XMM_CLOBBERS , "xmm0", "xmm1", "xmm2", "xmm3"
+#else
+#define XMM_CLOBBERS
+#endif
+
+// Dword that may alias any other type (and be unaligned)
+typedef uint32_t __attribute__((may_alias)) dword_alias_t;
+
+// Prevents the compiler from turning the loops below into calls to memset/memcpy (i.e. themselves).
+#define NO_LIBCALL __attribute__((optimize("no-tree-loop-distribute-patterns")))
+
+// Below this size, plain loops are faster than string instructions,
+// whose startup costs tens of cycles.
+#define SMALL_MAX 64
+
+// NOTE: the counts below are unsigned long so that they fill the whole ecx/rcx register.
+
+static inline void rep_stosd(uint8_t **dst, uint32_t value, unsigned long count) {
+    asm volatile("rep stosl" : "+D"(*dst), "+c"(count) : "a"(value) : "memory");
+}
+
+static inline void rep_movsd(uint8_t **dst, uint8_t **src, unsigned long count) {
+    asm volatile("rep movsl" : "+D"(*dst), "+S"(*src), "+c"(count) : : "memory");
+}
+
+// Fills count bytes with pattern (4 bytes, lowest byte first).
+// dst must be aligned on the period of pattern (see memfill_sse2).
+static NO_LIBCALL void fill_small(uint8_t *d, uint32_t pattern, uint_t count) {
+    for (; count >= 4; count -= 4, d += 4)
+        *(dword_alias_t *)d = pattern;
+    for (; count; count--, pattern = pattern >> 8 | pattern << 24)
+        *d++ = pattern;
+}
+
+static NO_LIBCALL void copy_small(uint8_t *d, uint8_t *s, uint_t count) {
+    for (; count >= 4; count -= 4, d += 4, s += 4)
+        *(dword_alias_t *)d = *(dword_alias_t *)s;
     while (count--)
-        *d++ = value;
+        *d++ = *s++;
+}
+
+// Same as fill_small, but uses rep stosd (dst aligned on 4 bytes) for large counts.
+static void fill_rep(void *dst, uint32_t pattern, uint_t count) {
+    uint8_t *d = dst;
+    if (count < SMALL_MAX) {
+        fill_small(d, pattern, count);
+        return;
+    }
+    uint_t head = -(uintptr_t)d & 3;
+    fill_small(d, pattern, head);
+    d += head;
+    count -= head;
+    rep_stosd(&d, pattern, count / 4);
+    fill_small(d, pattern, count & 3);
+}
+
+static void copy_rep(void *dst, void *src, uint_t count) {
+    uint8_t *d = dst;
+    uint8_t *s = src;
+    if (count < SMALL_MAX) {
+        copy_small(d, s, count);
+        return;
+    }
+    uint_t head = -(uintptr_t)d & 3;
+    copy_small(d, s, head);
+    d += head;
+    s += head;
+    count -= head;
+    rep_movsd(&d, &s, count / 4);
+    copy_small(d, s, count & 3);
+}
+
+// Same as fill_small, but stores 64 bytes per iteration with SSE2.
+void memfill_sse2(void *dst, uint32_t pattern, uint_t count) {
+    uint8_t *d = dst;
+    uint_t head = -(uintptr_t)d & 15;
+    if (head > count)
+        head = count;
+    fill_small(d, pattern, head);
+    d += head;
+    count -= head;
+
+    unsigned long blocks = count / 64;
+    if (blocks) {
+        asm volatile("movd %0,%%xmm0\n"
+                     "pshufd $0,%%xmm0,%%xmm0"
+                     : : "r"(pattern) : "memory" XMM_CLOBBERS);
+        if (count >= NON_TEMPORAL_MIN) {
+            asm volatile("1:\n"
+                         "movntdq %%xmm0,(%0)\n"
+                         "movntdq %%xmm0,16(%0)\n"
+                         "movntdq %%xmm0,32(%0)\n"
+                         "movntdq %%xmm0,48(%0)\n"
+                         "add $64,%0\n"
+                         "dec %1\n"
+                         "jnz 1b\n"
+                         "sfence"
+                         : "+r"(d), "+r"(blocks) : : "memory" XMM_CLOBBERS);
+        } else {
+            asm volatile("1:\n"
+                         "movdqa %%xmm0,(%0)\n"
+                         "movdqa %%xmm0,16(%0)\n"
+                         "movdqa %%xmm0,32(%0)\n"
+                         "movdqa %%xmm0,48(%0)\n"
+                         "add $64,%0\n"
+                         "dec %1\n"
+                         "jnz 1b"
+                         : "+r"(d), "+r"(blocks) : : "memory" XMM_CLOBBERS);
+        }
+    }
+    fill_small(d, pattern, count & 63);
+}
+
+// Copies 64 bytes per iteration with SSE2: dst is aligned on 16 bytes, src may not be.
+// Every block is entirely read before being written, which keeps forward overlapping
+// copies (dst < src) correct.
+void memcpy_sse2(void *dst, void *src, uint_t count) {
+    uint8_t *d = dst;
+    uint8_t *s = src;
+    uint_t head = -(uintptr_t)d & 15;
+    if (head > count)
+        head = count;
+    copy_small(d, s, head);
+    d += head;
+    s += head;
+    count -= head;
+
+    unsigned long blocks = count / 64;
+    if (blocks) {
+        if (count >= NON_TEMPORAL_MIN) {
+            asm volatile("1:\n"
+                         "movdqu (%1),%%xmm0\n"
+                         "movdqu 16(%1),%%xmm1\n"
+                         "movdqu 32(%1),%%xmm2\n"
+                         "movdqu 48(%1),%%xmm3\n"
+                         "movntdq %%xmm0,(%0)\n"
+                         "movntdq %%xmm1,16(%0)\n"
+                         "movntdq %%xmm2,32(%0)\n"
+                         "movntdq %%xmm3,48(%0)\n"
+                         "add $64,%1\n"
+                         "add $64,%0\n"
+                         "dec %2\n"
+                         "jnz 1b\n"
+                         "sfence"
+                         : "+r"(d), "+r"(s), "+r"(blocks) : : "memory" XMM_CLOBBERS);
+        } else {
+            asm volatile("1:\n"
+                         "movdqu (%1),%%xmm0\n"
+                         "movdqu 16(%1),%%xmm1\n"
+                         "movdqu 32(%1),%%xmm2\n"
+                         "movdqu 48(%1),%%xmm3\n"
+                         "movdqa %%xmm0,(%0)\n"
+                         "movdqa %%xmm1,16(%0)\n"
+                         "movdqa %%xmm2,32(%0)\n"
+                         "movdqa %%xmm3,48(%0)\n"
+                         "add $64,%1\n"
+                         "add $64,%0\n"
+                         "dec %2\n"
+                         "jnz 1b"
+                         : "+r"(d), "+r"(s), "+r"(blocks) : : "memory" XMM_CLOBBERS);
+        }
+    }
+    copy_small(d, s, count & 63);
+}
+
+static void (*fill_large)(void *dst, uint32_t pattern, uint_t count) = fill_rep;
+static void (*copy_large)(void *dst, void *src, uint_t count) = copy_rep;
+
+void mem_init(bool sse2) {
+    fill_large = sse2 ? memfill_sse2 : fill_rep;
+    copy_large = sse2 ? memcpy_sse2 : copy_rep;
+}
+
+void memset(void *dst, uint8_t value, uint_t count) {
+    uint32_t pattern = value * 0x01010101;
+    if (count >= LARGE_MIN)
+        fill_large(dst, pattern, count);
+    else
+        fill_rep(dst, pattern, count);
 }
 
 void memsetdw(void *dst, uint32_t value, uint_t count) {
-    uint32_t *d = dst;
-    while (count--)
-        *d++ = value;
+    if ((uintptr_t)dst & 3) {
+        uint8_t *d = dst;
+        rep_stosd(&d, value, count);
+    }
+    else if (count >= LARGE_MIN / 4)
+        fill_large(dst, value, count * 4);
+    else
+        fill_rep(dst, value, count * 4);
 }
 
 void memcpy(void *dst, void *src, uint_t count) {
+    if (count >= LARGE_MIN)
+        copy_large(dst, src, count);
+    else
+        copy_rep(dst, src, count);
+}
+
+void memcpydw(void *dst, void *src, uint_t count) {
+    memcpy(dst, src, count * 4);
+}
+
+// The backward copy does not use string instructions: they would need the direction flag set,
+// which interrupt handlers and syscall entries (hence rep movs/stos in kernel code) assume is clear.
+NO_LIBCALL void memmove(void *dst, void *src, uint_t count) {
     uint8_t *d = dst;
     uint8_t *s = src;
-    while (count--)
-        *d++ = *s++;
+    // Forward copies are safe unless dst overlaps the end of src
+    if (d <= s || d >= s + count) {
+        memcpy(dst, src, count);
+        return;
+    }
+    // Backward copy: trailing bytes first, then dwords, from the end down
+    for (; count & 3; count--)
+        d[count - 1] = s[count - 1];
+    for (; count; count -= 4)
+        *(dword_alias_t *)(d + count - 4) = *(dword_alias_t *)(s + count - 4);
 }
 
-void memcpydw(void *dst, void *src, uint_t count) {
-    uint32_t *d = dst;
-    uint32_t *s = src;
-    while (count--)
-        *d++ = *s++;
+int memcmp(void *p1, void *p2, uint_t count) {
+    uint8_t *a = p1;
+    uint8_t *b = p2;
+    // Skip identical dwords, then find the first differing byte
+    while (count >= 4 && *(dword_alias_t *)a == *(dword_alias_t *)b) {
+        a += 4;
+        b += 4;
+        count -= 4;
+    }
+    while (count--) {
+        if (*a != *b)
+            return *a - *b;
+        a++;
+        b++;
+    }
+    return 0;
 }
@@ -6,6 +6,12 @@
 #define memsetb memset
 #define memcpyb memcpy
 
+// Selects the implementation used for large fills and copies: SSE2 if sse2 is true,
+// string instructions (rep stosd/movsd) otherwise (default).
+// sse2 must only be true if the CPU supports SSE2 AND the OS enabled SSE (CR4.OSFXSR).
+// The kernel never calls it, since it does not own the SSE registers (see kernel/fpu.h).
+extern void mem_init(bool sse2);
+
 // Fills count bytes of the memory area pointed to by dst with the byte value.
 extern void memset(void *dst, uint8_t value, uint_t count);
 
@@ -20,4 +26,19 @@ extern void memcpy(void *dst, void *src, uint_t count);
 // NOTE: dword = double word = 32-bit
 extern void memcpydw(void *dst, void *src, uint_t count);
 
+// SSE2 versions of memset/memcpy, for callers that already checked that SSE is enabled
+// and own the SSE registers (in the kernel, see fpu_kernel_begin).
+// memfill_sse2 fills count bytes with the 4 bytes of pattern repeated (lowest byte first).
+// dst must be aligned on the period of the pattern, e.g. 2 bytes for a repeated 16-bit value.
+// memcpy_sse2 copies forward: the areas may only overlap if dst is below src.
+extern void memfill_sse2(void *dst, uint32_t pattern, uint_t count);
+extern void memcpy_sse2(void *dst, void *src, uint_t count);
+
+// Copy count bytes from src to dst. The areas may overlap.
+extern void memmove(void *dst, void *src, uint_t count);
+
+// Compares count bytes of p1 and p2. Returns 0 if they are equal, otherwise the difference
+// between the first differing bytes (as unsigned values).
+extern int memcmp(void *p1, void *p2, uint_t count);
+
 #endif
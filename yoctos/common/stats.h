@@ -0,0 +1,90 @@
+#ifndef _STATS_COMMON_H_
+#define _STATS_COMMON_H_
+
+#include "types.h"
+
+// Kernel statistics that can be retrieved from user space with the stats syscall.
+enum stats_t {
+    STATS_TIMER = 0,
+    STATS_TERM,
+    STATS_FPU,
+    STATS_TASKS,
+    STATS_FRAMES,
+    STATS_KMALLOC,
+    STATS_COUNT  // must always be last
+};
+
+// Results of STATS_TIMER. Durations are in timer ticks.
+typedef struct {
+    uint32_t freq;             // timer frequency in Hz
+    uint32_t ticks;            // ticks since boot
+    uint32_t idle_ticks;       // ticks during which no task was running
+    uint32_t pending_timers;   // kernel timers currently armed
+    uint32_t sleeps;           // completed sleeps
+    uint32_t jitter_total;     // sum of the wakeup delays (time between deadline and wakeup)
+    uint32_t jitter_max;       // longest wakeup delay
+} stats_timer_t;
+
+// Results of STATS_TERM.
+typedef struct {
+    uint32_t glyph_hits;       // characters drawn from the glyph cache
+    uint32_t glyph_misses;     // characters that had to be expanded from the font
+    uint32_t glyph_evictions;  // cached glyphs replaced by another one
+    uint32_t glyph_capacity;   // number of glyphs the cache can hold
+} stats_term_t;
+
+// Results of STATS_FPU.
+typedef struct {
+    uint32_t enabled;          // whether SSE is enabled (tasks may use the FPU/SSE)
+    uint32_t task_switches;    // task switches (including switches to the kernel)
+    uint32_t fpu_switches;     // times the FPU/SSE registers were saved and reloaded
+} stats_fpu_t;
+
+// Maximum number of tasks detailed by STATS_TASKS
+#define STATS_MAX_TASKS 8
+
+// Results of STATS_TASKS. Sizes are in KB.
+typedef struct {
+    uint32_t count;            // number of valid entries in tasks
+    uint32_t total;            // number of tasks, which exceeds count if some were left out
+    struct {
+        uint32_t id;
+        uint32_t reserved;     // size of the task's address space (image, heap and stack)
+        uint32_t resident;     // RAM actually allocated to the task (page tables included)
+        uint32_t shared;       // pages mapped to the task's module (not included in resident)
+        uint32_t page_faults;  // pages allocated on first touch or copied on first write
+        uint32_t kstack_used;  // deepest use of the task's kernel stack so far, in bytes
+    } tasks[STATS_MAX_TASKS];
+} stats_tasks_t;
+
+// Largest order of the blocks of the frame allocator: 2^10 frames (4MB)
+#define STATS_FRAME_MAX_ORDER 10
+
+// Results of STATS_FRAMES (physical frame allocator). A block of order n is 2^n contiguous frames.
+typedef struct {
+    uint32_t total;                                    // frames of RAM
+    uint32_t free;                                     // free frames
+    uint32_t free_blocks[STATS_FRAME_MAX_ORDER + 1];   // free blocks of each order
+    uint32_t largest_free_order;                       // order of the largest free block
+    uint32_t pool_frames;                              // pre-zeroed free frames (included in free)
+    uint32_t pool_hits;                                // single frame allocations served by the pool
+    uint32_t pool_misses;                              // single frame allocations zeroed on the spot
+} stats_frames_t;
+
+// Number of size classes of the kernel heap: 16 to 1024 bytes
+#define STATS_KMALLOC_CLASSES 7
+
+// Results of STATS_KMALLOC (kernel heap, see kernel/mem/kmalloc.h).
+typedef struct {
+    struct {
+        uint32_t size;         // size of the objects of the class in bytes
+        uint32_t in_use;       // objects currently allocated
+        uint32_t slabs;        // slabs (frames) currently held by the class
+        uint32_t allocs;       // allocations since boot
+    } classes[STATS_KMALLOC_CLASSES];
+    uint32_t large_in_use;     // allocations larger than the largest class, served by whole frames
+    uint32_t large_frames;     // frames held by these allocations
+    uint32_t failures;         // allocations that failed for lack of memory
+} stats_kmalloc_t;
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef _SYSCALL_NB_COMMON_H_
+#define _SYSCALL_NB_COMMON_H_
+
+// System call numbers, shared by the kernel (syscall.c) and the user space library (ulibc.c).
+// The number is passed in eax when issuing the system call.
+enum syscall_nb_t {
+    SYSCALL_TERM_PUTS = 0,
+    SYSCALL_TERM_SET_COLORS,
+    SYSCALL_KEYB_GET_KEY,
+    SYSCALL_TIMER_INFO,
+    SYSCALL_TIMER_SLEEP,
+    SYSCALL_VBE_FB_INFO,
+    SYSCALL_VBE_SETPIX,
+    SYSCALL_TASK_EXEC,
+    SYSCALL_PUTC,
+    SYSCALL_MOD_SIZE,
+    SYSCALL_TASK_ADDR_BY_ID,
+    SYSCALL_TASK_EXIT,
+    SYSCALL_KBENCH,
+    SYSCALL_TASK_SPAWN,
+    SYSCALL_STATS,
+    SYSCALL_SYSRING_ENTER,
+    SYSCALL_VBE_FILL_RECT,
+    SYSCALL_VBE_BLIT,
+    SYSCALL_VBE_COPY_RECT,
+    SYSCALL_VBE_FLUSH,
+    SYSCALL_SBRK,
+    SYSCALL_KEYB_READ,
+    SYSCALL_COUNT  // must always be last
+};
+
+// Modes of SYSCALL_KEYB_READ
+enum keyb_read_mode_t {
+    KEYB_READ_RAW = 0,  // keys as they are pressed (ints), at least one
+    KEYB_READ_LINE      // a whole line, edited and echoed by the kernel (null terminated string)
+};
+
+#endif
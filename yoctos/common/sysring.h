@@ -0,0 +1,42 @@
+#ifndef _SYSRING_COMMON_H_
+#define _SYSRING_COMMON_H_
+
+#include "types.h"
+
+// Syscall ring: a page shared between a task and the kernel in which the task queues
+// syscalls (submission queue) that are all executed by a single SYSCALL_SYSRING_ENTER.
+// The kernel posts their results into the completion queue.
+// The ring is mapped right below the task's code (TASK_VIRT_ADDR, see kernel/task/task.h).
+#define SYSRING_ADDR     (0x40000000 - 4096)
+#define SYSRING_ENTRIES  64  // must be a power of 2
+#define SYSRING_MASK     (SYSRING_ENTRIES - 1)
+
+// Submission flags
+#define SYSRING_F_NOCQE  1  // don't post a completion for this entry
+
+// Submission queue entry
+typedef struct {
+    uint16_t nb;         // syscall number (see syscall_nb.h)
+    uint16_t flags;      // SYSRING_F_xxx
+    uint32_t args[4];
+    uint32_t user_data;  // copied as is into the completion
+} sysring_sqe_t;
+
+// Completion queue entry
+typedef struct {
+    uint32_t user_data;
+    int32_t result;      // value returned by the syscall
+} sysring_cqe_t;
+
+// Indices are free running counters: an entry index is (counter & SYSRING_MASK).
+// The queue producer only writes the tail, the consumer only writes the head.
+typedef struct {
+    volatile uint32_t sq_head;  // written by the kernel
+    volatile uint32_t sq_tail;  // written by the task
+    volatile uint32_t cq_head;  // written by the task
+    volatile uint32_t cq_tail;  // written by the kernel
+    sysring_sqe_t sq[SYSRING_ENTRIES];
+    sysring_cqe_t cq[SYSRING_ENTRIES];
+} sysring_t;
+
+#endif
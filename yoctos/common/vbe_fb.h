@@ -13,4 +13,10 @@ typedef struct {
     uint8_t bpp;
 } vbe_fb_t;
 
+// Rectangle in screen coordinates (pixels)
+typedef struct {
+    int x, y;
+    int w, h;
+} vbe_rect_t;
+
 #endif
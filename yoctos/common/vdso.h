@@ -0,0 +1,25 @@
+#ifndef _VDSO_COMMON_H_
+#define _VDSO_COMMON_H_
+
+#include "types.h"
+
+// Timer page updated by the kernel on each timer tick and mapped read-only
+// into every task, so that reading the time doesn't require a syscall.
+// It lives in the page directory entry right below the syscall ring (see sysring.h).
+#define VDSO_ADDR  0x3F800000
+
+typedef struct {
+    // Sequence counter: odd while the kernel updates the fields below.
+    // Readers retry if it was odd or changed while they read (see vdso_read).
+    volatile uint32_t seq;
+    volatile uint32_t ticks;     // timer ticks since boot
+    volatile uint32_t freq;      // timer frequency in Hz
+    volatile uint64_t tsc;       // time-stamp counter value at the last tick
+    volatile uint32_t tsc_khz;   // TSC frequency in kHz, calibrated at boot (0 if unknown)
+    volatile uint32_t features;  // VDSO_FEATURE_xxx flags, set once at boot
+} vdso_t;
+
+// The kernel enabled SSE and preserves the SSE registers of every task
+#define VDSO_FEATURE_SSE  (1 << 0)
+
+#endif
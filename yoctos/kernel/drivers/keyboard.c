@@ -0,0 +1,177 @@
+#include "common/types.h"
+#include "common/colors.h"
+#include "pmio/pmio.h"
+#include "interrupt/irq.h"
+#include "keymaps/keymap.h"
+#include "task/task.h"
+#include "x86.h"
+#include "term.h"
+#include "keyboard.h"
+
+#define KEYB_DATA    0x60
+#define KEYB_STATUS  0x64
+
+// Status register: output buffer full (a scancode can be read),
+// input buffer full (the controller is not ready to receive a command)
+#define KEYB_STATUS_OUT  0x01
+#define KEYB_STATUS_IN   0x02
+
+// Sets the typematic rate and delay (followed by a data byte)
+#define KEYB_CMD_TYPEMATIC  0xF3
+
+// Released keys have bit 7 of their scancode set
+#define SCANCODE_RELEASED  0x80
+
+#define SC_LSHIFT  0x2A
+#define SC_RSHIFT  0x36
+
+// Size of the ring buffer (in keys): large enough for a line typed ahead while the reader is busy
+#define BUF_SIZE  128
+
+// Number of spaces a tab is expanded to in line mode
+#define TAB_SIZE  4
+
+// Active keymap (see keymaps/keymap.c)
+extern keymap_t *keymap;
+
+// Ring buffer of the keys pressed, filled by the IRQ handler.
+// IMPORTANT: it must only be accessed with interrupts disabled.
+static int buf[BUF_SIZE];
+static uint_t buf_read = 0;   // index of the oldest key
+static uint_t buf_count = 0;  // number of keys in the buffer
+static bool buf_full = false; // whether the overflow was already reported
+
+static bool lshift = false;
+static bool rshift = false;
+
+// Tasks blocked until a key is pressed (see keyb_wait_key)
+static task_waitq_t readers;
+
+static void keyboard_handler() {
+    if (!(inb(KEYB_STATUS) & KEYB_STATUS_OUT))
+        return;
+    uint8_t sc = inb(KEYB_DATA);
+
+    if (sc & SCANCODE_RELEASED) {
+        sc &= ~SCANCODE_RELEASED;
+        if (sc == SC_LSHIFT)
+            lshift = false;
+        else if (sc == SC_RSHIFT)
+            rshift = false;
+        return;
+    }
+    if (sc == SC_LSHIFT) {
+        lshift = true;
+        return;
+    }
+    if (sc == SC_RSHIFT) {
+        rshift = true;
+        return;
+    }
+
+    int key = (lshift || rshift) ? keymap->shift[sc] : keymap->normal[sc];
+    if (key == KEY_IGNORE)
+        return;
+
+    if (buf_count == BUF_SIZE) {
+        // The overflow is only reported once until a key is read
+        if (!buf_full) {
+            PRINT_STR("[keyboard buffer FULL!]", RED);
+            buf_full = true;
+        }
+        return;
+    }
+    buf[(buf_read + buf_count) % BUF_SIZE] = key;
+    buf_count++;
+    task_wake_all(&readers);
+}
+
+// Removes the oldest key from the buffer. Interrupts must be disabled.
+static int buf_pop() {
+    int key = buf[buf_read];
+    buf_read = (buf_read + 1) % BUF_SIZE;
+    buf_count--;
+    buf_full = false;
+    return key;
+}
+
+// Waits until the controller is ready to receive a byte, then sends it.
+static void keyb_write(uint8_t data) {
+    while (inb(KEYB_STATUS) & KEYB_STATUS_IN);
+    outb(KEYB_DATA, data);
+}
+
+void keyb_init() {
+    // Fastest repeat rate (30 keys/s) and shortest delay (250ms)
+    keyb_write(KEYB_CMD_TYPEMATIC);
+    keyb_write(0);
+
+    handler_t handler = { keyboard_handler, "keyboard" };
+    irq_install_handler(IRQ_KEYBOARD, handler);
+
+    term_puts("Keyboard initialized.\n");
+}
+
+int keyb_get_key() {
+    uint32_t flags = irq_save();
+    int key = buf_count ? buf_pop() : 0;
+    irq_restore(flags);
+    return key;
+}
+
+int keyb_wait_key() {
+    uint32_t flags = irq_save();
+    // The buffer is checked with interrupts disabled: a key cannot be missed between
+    // the check and the blocking, as the IRQ handler only runs once the task is switched out
+    while (!buf_count) {
+        if (task_current())
+            task_wait(&readers);
+        else
+            idle_wait();  // no task to block (kernel code)
+    }
+    int key = buf_pop();
+    irq_restore(flags);
+    return key;
+}
+
+int keyb_read(int *keys, uint_t count) {
+    if (!count)
+        return 0;
+    uint_t n = 0;
+    keys[n++] = keyb_wait_key();
+    while (n < count) {
+        int key = keyb_get_key();
+        if (!key)
+            break;
+        keys[n++] = key;
+    }
+    return n;
+}
+
+int keyb_read_line(char *line, uint_t size) {
+    if (!size)
+        return 0;
+    uint_t len = 0;
+    for (;;) {
+        int key = keyb_wait_key();
+        if (key == '\n')
+            break;
+        if (key == '\b') {
+            if (len > 0) {
+                term_putc('\b');
+                len--;
+            }
+        } else if (key == '\t') {
+            for (int i = 0; i < TAB_SIZE && len < size - 1; i++) {
+                term_putc(' ');
+                line[len++] = ' ';
+            }
+        } else if (key < 256 && len < size - 1) {
+            // Special keys (arrows, function keys, etc.) have no character
+            term_putc(key);
+            line[len++] = key;
+        }
+    }
+    line[len] = 0;
+    return len;
+}
@@ -1,10 +1,25 @@
 #ifndef _KEYBOARD_H_
 #define _KEYBOARD_H_
 
+#include "common/types.h"
+
 extern void keyb_init();
 
 // Returns the key that was pressed or 0 if no key is present in the internal buffer.
 // This function never blocks.
 extern int keyb_get_key();
 
+// Returns the next key, blocking the calling task until one is pressed.
+extern int keyb_wait_key();
+
+// Stores up to count keys into keys, blocking until at least one is available.
+// Returns the number of keys stored.
+extern int keyb_read(int *keys, uint_t count);
+
+// Line discipline: reads keys until enter is pressed, echoing them on the terminal.
+// Backspace erases the last character and tabs are expanded to spaces; keys with no character
+// and characters beyond size-1 are dropped. The line is null terminated, without the newline.
+// Returns the length of the line.
+extern int keyb_read_line(char *line, uint_t size);
+
 #endif
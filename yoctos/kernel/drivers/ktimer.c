@@ -0,0 +1,132 @@
+#include "common/types.h"
+#include "x86.h"
+#include "ktimer.h"
+
+// Hierarchical timer wheel, as described in "Hashed and Hierarchical Timing Wheels"
+// (Varghese & Lauck) and used by Linux 2.4.
+// The first wheel has one slot per tick for the next 256 ticks. Each of the
+// 4 following wheels has 64 slots, a slot covering a whole revolution of the
+// previous wheel. When a wheel completes a revolution, the next slot of the upper
+// wheel is "cascaded": its timers are redistributed into the lower wheels.
+// Adding, removing and firing a timer is O(1), whatever the number of pending timers.
+
+#define TVR_BITS  8
+#define TVN_BITS  6
+#define TVR_SIZE  (1 << TVR_BITS)
+#define TVN_SIZE  (1 << TVN_BITS)
+#define TVR_MASK  (TVR_SIZE - 1)
+#define TVN_MASK  (TVN_SIZE - 1)
+#define TVN_COUNT 4
+
+static ktimer_t *tv1[TVR_SIZE];
+static ktimer_t *tvn[TVN_COUNT][TVN_SIZE];
+
+// Next tick to process: every timer expiring before it has already fired.
+static uint_t wheel_ticks;
+static uint_t pending_count;
+
+static void slot_insert(ktimer_t **slot, ktimer_t *timer) {
+    timer->next = *slot;
+    if (*slot)
+        (*slot)->pprev = &timer->next;
+    *slot = timer;
+    timer->pprev = slot;
+}
+
+static void slot_remove(ktimer_t *timer) {
+    *timer->pprev = timer->next;
+    if (timer->next)
+        timer->next->pprev = timer->pprev;
+    timer->next = NULL;
+    timer->pprev = NULL;
+}
+
+// Places the timer in the slot matching its deadline, relative to wheel_ticks.
+static void wheel_insert(ktimer_t *timer) {
+    uint_t expires = timer->expires;
+    uint_t idx = expires - wheel_ticks;
+
+    if ((int)idx < 0) {
+        // Already expired: fires on the next processed tick
+        slot_insert(&tv1[wheel_ticks & TVR_MASK], timer);
+    } else if (idx < TVR_SIZE) {
+        slot_insert(&tv1[expires & TVR_MASK], timer);
+    } else {
+        for (uint_t n = 0; n < TVN_COUNT; n++) {
+            uint_t shift = TVR_BITS + (n + 1) * TVN_BITS;
+            if (n == TVN_COUNT - 1 || idx < (1U << shift)) {
+                uint_t i = (expires >> (TVR_BITS + n * TVN_BITS)) & TVN_MASK;
+                slot_insert(&tvn[n][i], timer);
+                break;
+            }
+        }
+    }
+}
+
+// Redistributes the timers of the current slot of wheel n into the lower wheels.
+// Returns the index of the slot that was cascaded.
+static uint_t cascade(uint_t n) {
+    uint_t i = (wheel_ticks >> (TVR_BITS + n * TVN_BITS)) & TVN_MASK;
+    ktimer_t *timer = tvn[n][i];
+    tvn[n][i] = NULL;
+    while (timer) {
+        ktimer_t *next = timer->next;
+        wheel_insert(timer);
+        timer = next;
+    }
+    return i;
+}
+
+void ktimer_init(uint_t now) {
+    for (uint_t i = 0; i < TVR_SIZE; i++)
+        tv1[i] = NULL;
+    for (uint_t n = 0; n < TVN_COUNT; n++)
+        for (uint_t i = 0; i < TVN_SIZE; i++)
+            tvn[n][i] = NULL;
+    wheel_ticks = now;
+    pending_count = 0;
+}
+
+void ktimer_add(ktimer_t *timer) {
+    uint32_t flags = irq_save();
+    if (timer->pprev)
+        slot_remove(timer);
+    else
+        pending_count++;
+    wheel_insert(timer);
+    irq_restore(flags);
+}
+
+bool ktimer_del(ktimer_t *timer) {
+    uint32_t flags = irq_save();
+    bool pending = timer->pprev != NULL;
+    if (pending) {
+        slot_remove(timer);
+        pending_count--;
+    }
+    irq_restore(flags);
+    return pending;
+}
+
+void ktimer_run(uint_t now) {
+    while ((int)(now - wheel_ticks) >= 0) {
+        uint_t idx = wheel_ticks & TVR_MASK;
+        // The first wheel starts a new revolution: refill it from the upper wheels
+        if (idx == 0) {
+            for (uint_t n = 0; n < TVN_COUNT && cascade(n) == 0; n++)
+                ;
+        }
+
+        ktimer_t *timer;
+        while ((timer = tv1[idx])) {
+            slot_remove(timer);
+            pending_count--;
+            timer->func(timer->data);
+        }
+        wheel_ticks++;
+    }
+}
+
+uint_t ktimer_pending() {
+    return pending_count;
+}
@@ -0,0 +1,33 @@
+#ifndef _KTIMER_H_
+#define _KTIMER_H_
+
+#include "common/types.h"
+
+// Kernel timer: func(data) is called from the timer IRQ once the tick count
+// reaches "expires". The structure is owned by the caller (no allocation) and
+// must stay valid until the timer either fired or was removed with ktimer_del().
+typedef struct ktimer_st {
+    uint_t expires;              // absolute tick at which the timer fires
+    void (*func)(void *data);
+    void *data;
+    struct ktimer_st *next;      // next timer in the same wheel slot
+    struct ktimer_st **pprev;    // pointer to the previous link (NULL if not pending)
+} ktimer_t;
+
+// Initializes the timer wheel, starting at the specified tick.
+extern void ktimer_init(uint_t now);
+
+// Arms the timer. A timer whose deadline already passed fires on the next tick.
+extern void ktimer_add(ktimer_t *timer);
+
+// Disarms the timer if it is pending. Returns true if it was pending.
+extern bool ktimer_del(ktimer_t *timer);
+
+// Fires all the timers that expired up to tick "now" (included).
+// Called by the timer IRQ handler.
+extern void ktimer_run(uint_t now);
+
+// Returns the number of pending timers.
+extern uint_t ktimer_pending();
+
+#endif
@@ -0,0 +1,275 @@
+#include "common/types.h"
+#include "common/colors.h"
+#include "common/stdio.h"
+#include "x86.h"
+#include "font.h"
+#include "vbe.h"
+#include "term.h"
+
+#define TAB_SIZE 4
+
+// Maximum number of text columns and lines (i.e. 2048x2048 resolution)
+#define TERM_MAX_COLS  256
+#define TERM_MAX_LINES 128
+
+// Content of a text cell
+typedef struct {
+    uint16_t fg;
+    uint16_t bg;
+    uint8_t c;
+} cell_t;
+
+static term_colors_t colors;
+static int cursor_y;
+static int cursor_x;
+
+// Number of text columns and lines on screen
+static int cols;
+static int lines;
+
+// Shadow buffer: text lines form a ring, screen line y is stored in cells[(top+y)%lines].
+// Scrolling only moves top and clears the new last line.
+static cell_t cells[TERM_MAX_LINES][TERM_MAX_COLS];
+static int top;
+
+// Cells currently displayed, indexed by screen line: only the cells that differ
+// from the shadow buffer are redrawn (see refresh).
+static cell_t shown[TERM_MAX_LINES][TERM_MAX_COLS];
+
+// Range of screen lines modified since the last refresh (empty if first > last)
+static int dirty_first;
+static int dirty_last;
+
+// Glyph cache: 2-way set associative table of glyphs expanded to 16bpp for a given
+// (character, fg, bg) triple. For a given pair of colors, all characters map to different sets.
+#define GLYPH_CACHE_SETS 256
+#define GLYPH_CACHE_WAYS 2
+
+typedef struct {
+    bool valid;
+    uint8_t c;
+    uint16_t fg;
+    uint16_t bg;
+    uint16_t pix[FONT_HEIGHT * FONT_WIDTH];
+} glyph_t;
+
+static glyph_t glyph_cache[GLYPH_CACHE_SETS][GLYPH_CACHE_WAYS];
+static uint8_t glyph_lru[GLYPH_CACHE_SETS];  // least recently used way of each set
+static uint32_t glyph_hits;
+static uint32_t glyph_misses;
+static uint32_t glyph_evictions;
+
+#define LINE(y) cells[(top + (y)) % lines]
+
+static bool cell_equal(cell_t *a, cell_t *b) {
+    return a->c == b->c && a->fg == b->fg && a->bg == b->bg;
+}
+
+static void set_cell(int x, int y, char c, term_colors_t color) {
+    cell_t *cell = &LINE(y)[x];
+    cell->c = c;
+    cell->bg = color.bg;
+    // Blank cells look the same whatever their foreground color
+    cell->fg = c == ' ' ? color.bg : color.fg;
+    if (y < dirty_first)
+        dirty_first = y;
+    if (y > dirty_last)
+        dirty_last = y;
+}
+
+static void clear_line(cell_t *line, uint16_t bg) {
+    for (int x = 0; x < cols; x++)
+        line[x] = (cell_t){ bg, bg, ' ' };
+}
+
+// Draws the cells of the modified lines that differ from what is on screen.
+static void refresh() {
+    for (int y = dirty_first; y <= dirty_last; y++) {
+        cell_t *src = LINE(y);
+        cell_t *dst = shown[y];
+        for (int x = 0; x < cols; x++) {
+            if (!cell_equal(&src[x], &dst[x])) {
+                term_setchar(src[x].c, x, y, (term_colors_t){ src[x].fg, src[x].bg });
+                dst[x] = src[x];
+            }
+        }
+    }
+    dirty_first = lines;
+    dirty_last = -1;
+}
+
+void term_clear() {
+    vbe_fb_t *fb = vbe_get_fb();
+    cols = fb->width / FONT_WIDTH;
+    lines = fb->height / FONT_HEIGHT;
+    if (cols > TERM_MAX_COLS)
+        cols = TERM_MAX_COLS;
+    if (lines > TERM_MAX_LINES)
+        lines = TERM_MAX_LINES;
+    vbe_clear(0);
+    for (int y = 0; y < lines; y++) {
+        clear_line(cells[y], BLACK);
+        clear_line(shown[y], BLACK);
+    }
+    top = 0;
+    dirty_first = lines;
+    dirty_last = -1;
+    cursor_x = 0;
+    cursor_y = 0;
+    colors = (term_colors_t){ LIGHT_GREY, BLACK };
+    vbe_flush();
+}
+
+void term_init() {
+    term_clear();
+}
+
+term_colors_t term_getcolors() {
+    return colors;
+}
+
+void term_setcolors(term_colors_t col) {
+    colors = col;
+}
+
+void term_setfgcolor(uint16_t foreground) {
+    colors.fg = foreground;
+}
+
+void term_setbgcolor(uint16_t background) {
+    colors.bg = background;
+}
+
+// Returns the glyph of character c expanded with the specified colors, from the cache if possible.
+static glyph_t *glyph_get(uint8_t c, term_colors_t color) {
+    uint_t set = (c ^ color.fg ^ (color.fg >> 8) ^ (color.bg * 7) ^ (color.bg >> 8)) % GLYPH_CACHE_SETS;
+    glyph_t *ways = glyph_cache[set];
+    for (int w = 0; w < GLYPH_CACHE_WAYS; w++) {
+        glyph_t *g = &ways[w];
+        if (g->valid && g->c == c && g->fg == color.fg && g->bg == color.bg) {
+            glyph_lru[set] = !w;
+            glyph_hits++;
+            return g;
+        }
+    }
+
+    glyph_misses++;
+    int w = glyph_lru[set];
+    glyph_t *g = &ways[w];
+    if (g->valid)
+        glyph_evictions++;
+    glyph_lru[set] = !w;
+
+    uint8_t *bits = &font_8x16[c * FONT_HEIGHT];
+    uint16_t *pix = g->pix;
+    for (int i = 0; i < FONT_HEIGHT; i++) {
+        for (int b = FONT_WIDTH - 1; b >= 0; b--)
+            *pix++ = (bits[i] & (1 << b)) ? color.fg : color.bg;
+    }
+    g->valid = true;
+    g->c = c;
+    g->fg = color.fg;
+    g->bg = color.bg;
+    return g;
+}
+
+// Draws character c at text position (x,y).
+void term_setchar(char c, int x, int y, term_colors_t color) {
+    // The logo is drawn from the timer interrupt: protect the cache entry until it is copied
+    uint32_t flags = irq_save();
+    glyph_t *g = glyph_get((uint8_t)c, color);
+    vbe_rect_t r = { x * FONT_WIDTH, y * FONT_HEIGHT, FONT_WIDTH, FONT_HEIGHT };
+    vbe_blit(&r, g->pix, FONT_WIDTH);
+    irq_restore(flags);
+}
+
+void term_glyph_stats(stats_term_t *stats) {
+    stats->glyph_hits = glyph_hits;
+    stats->glyph_misses = glyph_misses;
+    stats->glyph_evictions = glyph_evictions;
+    stats->glyph_capacity = GLYPH_CACHE_SETS * GLYPH_CACHE_WAYS;
+}
+
+// Scrolls the text up by one line: the screen itself is updated by the next refresh.
+static void scroll() {
+    top = (top + 1) % lines;
+    clear_line(LINE(lines - 1), colors.bg);
+    dirty_first = 0;
+    dirty_last = lines - 1;
+}
+
+// Writes character c into the shadow buffer only.
+static void putc_noflush(char c) {
+    // Output before term_init() (e.g. paging_init messages)
+    if (!lines)
+        term_clear();
+
+    int x = cursor_x;
+    int y = cursor_y;
+
+    if (c == '\t') {
+        x += TAB_SIZE;
+    }
+    else if (c == '\n') {
+        y++;
+        x = 0;
+    }
+    else if (c == '\b') {
+        if (x == 0 && y == 0)
+            return;
+        x--;
+        if (x < 0) {
+            y--;
+            x = cols - 1;
+        }
+        set_cell(x, y, ' ', colors);
+    }
+    else {
+        set_cell(x, y, c, colors);
+        x++;
+    }
+
+    if (x >= cols) {
+        x -= cols;
+        y++;
+    }
+    if (y >= lines) {
+        scroll();
+        y--;
+    }
+
+    cursor_x = x;
+    cursor_y = y;
+}
+
+void term_putc(char c) {
+    putc_noflush(c);
+    refresh();
+    vbe_flush();
+}
+
+void term_puts(char *s) {
+    while (*s)
+        putc_noflush(*s++);
+    refresh();
+    vbe_flush();
+}
+
+void term_printf(char *fmt, ...) {
+    char buffer[4096];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(buffer, sizeof(buffer), fmt, args);
+    va_end(args);
+    term_puts(buffer);
+}
+
+void term_setcursor(int x, int y) {
+    cursor_x = x;
+    cursor_y = y;
+}
+
+void term_getcursor(int *x, int *y) {
+    *x = cursor_x;
+    *y = cursor_y;
+}
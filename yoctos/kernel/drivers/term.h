@@ -3,6 +3,7 @@
 
 #include "common/types.h"
 #include "common/colors.h"
+#include "common/stats.h"
 
 extern void term_init();
 extern void term_clear();
@@ -17,6 +18,9 @@ extern void term_putc(char c);
 extern void term_puts(char *s);
 extern void term_printf(char *fmt, ...);
 
+// Fills the glyph cache statistics.
+extern void term_glyph_stats(stats_term_t *stats);
+
 extern void term_getcursor(int *x, int *y);
 extern void term_setcursor(int x, int y);
 
@@ -0,0 +1,135 @@
+#include "common/types.h"
+#include "common/cpu.h"
+#include "common/vdso.h"
+#include "mem/frame.h"
+#include "pmio/pmio.h"
+#include "interrupt/irq.h"
+#include "task/task.h"
+#include "logo.h"
+#include "x86.h"
+#include "term.h"
+#include "ktimer.h"
+#include "timer.h"
+
+// PIT (Programmable Interval Timer) input clock in Hz
+#define PIT_FREQ      1193180
+
+#define PIT_CHANNEL0  0x40
+#define PIT_CHANNEL2  0x42
+#define PIT_CMD       0x43
+
+// Port controlling the PIT channel 2 gate (bit 0) and reporting its output (bit 5)
+#define PIT_CH2_CTRL  0x61
+
+// Duration of the TSC calibration in milliseconds (the PIT count must fit in 16 bits)
+#define TSC_CALIBRATION_MS  50
+
+static uint_t freq;
+static volatile uint_t ticks;
+
+// Timer page shared with the tasks (see common/vdso.h)
+static vdso_t *vdso;
+
+static void vdso_update() {
+    vdso->seq++;
+    asm volatile("" : : : "memory");
+    vdso->ticks = ticks;
+    if (vdso->tsc_khz)
+        vdso->tsc = rdtsc();
+    asm volatile("" : : : "memory");
+    vdso->seq++;
+}
+
+static void timer_handler() {
+    ticks++;
+    vdso_update();
+    ktimer_run(ticks);
+    logo_render();
+}
+
+// Measures the TSC frequency by counting cycles during a one-shot countdown
+// of the PIT channel 2. Returns 0 if the CPU has no TSC.
+static uint_t tsc_calibrate() {
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    if (!(edx & CPUID_EDX_TSC))
+        return 0;
+
+    uint_t count = PIT_FREQ * TSC_CALIBRATION_MS / 1000;
+    uint32_t flags = irq_save();
+    // Gate channel 2 on, speaker off
+    outb(PIT_CH2_CTRL, (inb(PIT_CH2_CTRL) & ~0x02) | 0x01);
+    // Channel 2, lobyte/hibyte access, mode 0 (interrupt on terminal count)
+    outb(PIT_CMD, 0xb0);
+    outb(PIT_CHANNEL2, count & 0xff);
+    outb(PIT_CHANNEL2, (count >> 8) & 0xff);
+
+    uint64_t start = rdtsc();
+    while (!(inb(PIT_CH2_CTRL) & 0x20))
+        ;
+    uint64_t cycles = rdtsc() - start;
+    irq_restore(flags);
+
+    return cycles / TSC_CALIBRATION_MS;
+}
+
+void timer_init(uint_t freq_hz) {
+    uint_t div;
+    // The divisor is a 16-bit value: the lowest frequency is about 18.2Hz
+    if (freq_hz <= 18) {
+        div = 0xffff;
+        freq = 18;
+    } else {
+        div = PIT_FREQ / freq_hz;
+        freq = PIT_FREQ / div;
+    }
+
+    ktimer_init(ticks);
+
+    vdso = frame_alloc();
+    vdso->freq = freq;
+    vdso->tsc_khz = tsc_calibrate();
+    vdso_update();
+
+    // Channel 0, lobyte/hibyte access, mode 3 (square wave generator)
+    outb(PIT_CMD, 0x36);
+    outb(PIT_CHANNEL0, div & 0xff);
+    outb(PIT_CHANNEL0, (div >> 8) & 0xff);
+
+    handler_t handler = { timer_handler, "timer" };
+    irq_install_handler(IRQ_TIMER, handler);
+
+    term_printf("Timer initialized (%dHz, TSC %dMHz).\n", freq, vdso->tsc_khz / 1000);
+    logo_init();
+}
+
+uint_t timer_get_freq() {
+    return freq;
+}
+
+uint_t timer_get_ticks() {
+    return ticks;
+}
+
+vdso_t *timer_get_vdso() {
+    return vdso;
+}
+
+uint_t timer_ms_to_ticks(uint_t ms) {
+    // Rounded up so that we never sleep less than requested
+    return ((uint64_t)ms * freq + 999) / 1000;
+}
+
+void timer_sleep(uint_t ms) {
+    uint_t count = timer_ms_to_ticks(ms);
+    if (task_current()) {
+        task_sleep(count);
+    } else {
+        // No task to block (kernel code): halts the CPU until enough ticks elapsed
+        uint_t start = ticks;
+        uint32_t flags = irq_save();
+        while (ticks - start < count)
+            idle_wait();
+        irq_restore(flags);
+    }
+}
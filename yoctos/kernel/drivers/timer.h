@@ -1,6 +1,9 @@
 #ifndef _TIMER_H_
 #define _TIMER_H_
 
+#include "common/types.h"
+#include "common/vdso.h"
+
 // Initializes the timer with the specified frequency in Hz.
 // Note that the effective frequency might be different than the desired one.
 // Use timer_get_freq() to obtain the effective frequency.
@@ -9,10 +12,17 @@ extern void timer_init(uint_t freq_hz);
 // Returns the number of ticks since boot.
 extern uint_t timer_get_ticks();
 
-// Sleeps (actively) the specified time in milliseconds.
+// Sleeps the specified time in milliseconds.
+// The calling task is blocked (see task_sleep) and other tasks are scheduled meanwhile.
 extern void timer_sleep(uint_t ms);
 
+// Converts a duration in milliseconds into a number of ticks (rounded up).
+extern uint_t timer_ms_to_ticks(uint_t ms);
+
 // Returns the timer frequency in Hz.
 extern uint_t timer_get_freq();
 
+// Returns the timer page shared with the tasks (allocated by timer_init).
+extern vdso_t *timer_get_vdso();
+
 #endif
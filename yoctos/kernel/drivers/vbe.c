@@ -0,0 +1,321 @@
+#include "common/types.h"
+#include "common/mem.h"
+#include "common/colors.h"
+#include "boot/multiboot.h"
+#include "mem/frame.h"
+#include "x86.h"
+#include "fpu.h"
+#include "vbe.h"
+
+// Highest supported vertical resolution when using the back buffer
+#define VBE_MAX_HEIGHT 2048
+
+// Areas of at least this many pixels are drawn with SSE2 (if enabled):
+// below, saving and restoring the SSE registers costs more than it saves.
+#define VBE_SSE_MIN_PIXELS 2048
+
+// Largest number of pixels copied to the framebuffer with interrupts disabled (see copy_rows)
+#define VBE_BURST_PIXELS 32768
+
+static vbe_fb_t fb;
+
+// Buffer all drawing functions write to: either the framebuffer itself
+// or the back buffer (see vbe_backbuffer_init).
+static uint16_t *draw;
+static uint16_t *backbuffer = NULL;
+
+// Dirty area of the back buffer: for each row, the span [dirty_x0,dirty_x1) of pixels
+// modified since the last flush. Dirty rows are all within [dirty_y0,dirty_y1).
+static uint16_t dirty_x0[VBE_MAX_HEIGHT];
+static uint16_t dirty_x1[VBE_MAX_HEIGHT];
+static int dirty_y0, dirty_y1;
+
+void vbe_init() {
+    multiboot_info_t *mbi = multiboot_get_info();
+    fb.addr = (uint16_t *)(uint32_t)mbi->framebuffer_addr;
+    fb.pitch_in_bytes = mbi->framebuffer_pitch;
+    fb.width = mbi->framebuffer_width;
+    fb.height = mbi->framebuffer_height;
+    fb.bpp = mbi->framebuffer_bpp;
+    fb.size = fb.pitch_in_bytes * fb.height;
+    fb.pitch_in_pix = fb.pitch_in_bytes / (fb.bpp / 8);
+    draw = fb.addr;
+}
+
+vbe_fb_t *vbe_get_fb() {
+    return &fb;
+}
+
+// Adds the (already clipped) rectangle to the dirty area.
+static void mark_dirty(int x, int y, int w, int h) {
+    if (!backbuffer)
+        return;
+    uint32_t flags = irq_save();
+    for (int i = y; i < y + h; i++) {
+        if (dirty_x0[i] >= dirty_x1[i]) {
+            dirty_x0[i] = x;
+            dirty_x1[i] = x + w;
+        } else {
+            if (x < dirty_x0[i])
+                dirty_x0[i] = x;
+            if (x + w > dirty_x1[i])
+                dirty_x1[i] = x + w;
+        }
+    }
+    if (dirty_y0 >= dirty_y1) {
+        dirty_y0 = y;
+        dirty_y1 = y + h;
+    } else {
+        if (y < dirty_y0)
+            dirty_y0 = y;
+        if (y + h > dirty_y1)
+            dirty_y1 = y + h;
+    }
+    irq_restore(flags);
+}
+
+void vbe_setpixel(int x, int y, uint16_t color) {
+    draw[y * fb.pitch_in_pix + x] = color;
+    mark_dirty(x, y, 1, 1);
+}
+
+uint16_t vbe_getpixel(int x, int y) {
+    return draw[y * fb.pitch_in_pix + x];
+}
+
+// Clips the rectangle to the screen.
+// Returns false if nothing is left to draw.
+static bool clip(vbe_rect_t *r) {
+    // The coordinates come from tasks: nothing below may overflow, whatever their values.
+    // Once w and h are known to be positive, adding a negative x/y to them cannot overflow,
+    // and neither can subtracting a positive x/y from the screen size.
+    if (r->w <= 0 || r->h <= 0)
+        return false;
+    if (r->x < 0) {
+        r->w += r->x;
+        r->x = 0;
+    }
+    if (r->y < 0) {
+        r->h += r->y;
+        r->y = 0;
+    }
+    if (r->w > (int)fb.width - r->x)
+        r->w = fb.width - r->x;
+    if (r->h > (int)fb.height - r->y)
+        r->h = fb.height - r->y;
+    return r->w > 0 && r->h > 0;
+}
+
+// Starts drawing an area of the specified number of pixels.
+// Returns true if SSE2 must be used to draw it, in which case vec_end must be called once done.
+static bool vec_begin(uint_t pixels, uint32_t *flags) {
+    if (pixels < VBE_SSE_MIN_PIXELS || !fpu_sse_enabled())
+        return false;
+    *flags = fpu_kernel_begin();
+    return true;
+}
+
+static void vec_end(bool vec, uint32_t flags) {
+    if (vec)
+        fpu_kernel_end(flags);
+}
+
+// Fills count pixels starting at dst with 32-bit stores (128-bit if vec is true).
+static void fill_pixels(uint16_t *dst, uint32_t color32, uint_t count, bool vec) {
+    if (vec) {
+        memfill_sse2(dst, color32, count * 2);
+        return;
+    }
+    if (((uint32_t)dst & 3) && count) {
+        *dst++ = color32;
+        count--;
+    }
+    memsetdw(dst, color32, count / 2);
+    if (count & 1)
+        dst[count - 1] = color32;
+}
+
+// Copies count pixels from src to dst (non overlapping, or dst below src).
+// If vec is false, 32-bit copies are used whenever both buffers can be aligned together.
+static void copy_pixels(uint16_t *dst, uint16_t *src, uint_t count, bool vec) {
+    if (vec) {
+        memcpy_sse2(dst, src, count * 2);
+    } else if ((((uint32_t)dst ^ (uint32_t)src) & 3) == 0) {
+        if (((uint32_t)dst & 3) && count) {
+            *dst++ = *src++;
+            count--;
+        }
+        memcpydw(dst, src, count / 2);
+        if (count & 1)
+            dst[count - 1] = src[count - 1];
+    } else {
+        while (count--)
+            *dst++ = *src++;
+    }
+}
+
+void vbe_clear(uint16_t color) {
+    uint32_t flags;
+    bool vec = vec_begin(fb.size / 2, &flags);
+    fill_pixels(draw, COLTO32(color), fb.size / 2, vec);
+    vec_end(vec, flags);
+    mark_dirty(0, 0, fb.width, fb.height);
+}
+
+void vbe_fill_rect(vbe_rect_t *rect, uint16_t color) {
+    vbe_rect_t r = *rect;
+    if (!clip(&r))
+        return;
+    uint16_t *row = draw + r.y * fb.pitch_in_pix + r.x;
+    uint32_t flags;
+    bool vec = vec_begin(r.w * r.h, &flags);
+    for (int i = 0; i < r.h; i++) {
+        fill_pixels(row, COLTO32(color), r.w, vec);
+        row += fb.pitch_in_pix;
+    }
+    vec_end(vec, flags);
+    mark_dirty(r.x, r.y, r.w, r.h);
+}
+
+void vbe_blit(vbe_rect_t *rect, uint16_t *src, uint_t src_pitch_in_pix) {
+    vbe_rect_t r = *rect;
+    if (!clip(&r))
+        return;
+    // Skips the source pixels that were clipped out
+    src += (r.y - rect->y) * src_pitch_in_pix + (r.x - rect->x);
+    uint16_t *row = draw + r.y * fb.pitch_in_pix + r.x;
+    uint32_t flags;
+    bool vec = vec_begin(r.w * r.h, &flags);
+    for (int i = 0; i < r.h; i++) {
+        copy_pixels(row, src, r.w, vec);
+        row += fb.pitch_in_pix;
+        src += src_pitch_in_pix;
+    }
+    vec_end(vec, flags);
+    mark_dirty(r.x, r.y, r.w, r.h);
+}
+
+void vbe_copy_rect(vbe_rect_t *dst_rect, int src_x, int src_y) {
+    vbe_rect_t r = *dst_rect;
+    // Clips the destination, then the source (expressed as the destination moved back)
+    if (!clip(&r))
+        return;
+    // The shifts are smaller than the initial size (see clip). A source moved beyond the
+    // largest int would be off screen anyway.
+    int dx = r.x - dst_rect->x;
+    int dy = r.y - dst_rect->y;
+    if (src_x > 0x7FFFFFFF - dx || src_y > 0x7FFFFFFF - dy)
+        return;
+    src_x += dx;
+    src_y += dy;
+    vbe_rect_t s = { src_x, src_y, r.w, r.h };
+    if (!clip(&s))
+        return;
+    r.x += s.x - src_x;
+    r.y += s.y - src_y;
+    r.w = s.w;
+    r.h = s.h;
+
+    int pitch = fb.pitch_in_pix;
+    uint16_t *dst = draw + r.y * pitch + r.x;
+    uint16_t *src = draw + s.y * pitch + s.x;
+    mark_dirty(r.x, r.y, r.w, r.h);
+
+    // Overlapping areas: rows are copied bottom-up when moving down
+    if (r.y > s.y) {
+        dst += (r.h - 1) * pitch;
+        src += (r.h - 1) * pitch;
+        pitch = -pitch;
+    }
+    // Moving right within the same rows: each row is copied backward
+    bool backward = r.y == s.y && r.x > s.x;
+    uint32_t flags;
+    bool vec = !backward && vec_begin(r.w * r.h, &flags);
+    for (int i = 0; i < r.h; i++) {
+        if (backward) {
+            for (int j = r.w - 1; j >= 0; j--)
+                dst[j] = src[j];
+        } else {
+            copy_pixels(dst, src, r.w, vec);
+        }
+        dst += pitch;
+        src += pitch;
+    }
+    vec_end(vec, flags);
+}
+
+bool vbe_backbuffer_init() {
+    if (backbuffer)
+        return true;
+    if (fb.height > VBE_MAX_HEIGHT)
+        return false;
+    uint16_t *buf = frame_alloc_contiguous(FRAME_COUNT(fb.size));
+    if (buf == (uint16_t *)0xFFFFFFFF)
+        return false;
+
+    // Starts from what is currently displayed
+    memcpydw(buf, fb.addr, fb.size / 4);
+    dirty_y0 = dirty_y1 = 0;
+    for (uint_t i = 0; i < fb.height; i++)
+        dirty_x0[i] = dirty_x1[i] = 0;
+    backbuffer = buf;
+    draw = buf;
+    return true;
+}
+
+// Copies the rectangle (already clipped) from src, a buffer with the layout of the framebuffer,
+// to the framebuffer. SSE2 is used with interrupts disabled (see vec_begin): the rows are copied
+// by bursts of at most VBE_BURST_PIXELS pixels, so that interrupts are not delayed for a whole frame.
+static void copy_rows(uint16_t *src, int x, int y, int w, int h) {
+    int rows = VBE_BURST_PIXELS / w;
+    if (rows == 0)
+        rows = 1;
+    while (h > 0) {
+        int n = h < rows ? h : rows;
+        uint32_t flags;
+        bool vec = vec_begin(n * w, &flags);
+        for (int i = 0; i < n; i++) {
+            uint32_t offset = (y + i) * fb.pitch_in_pix + x;
+            copy_pixels(fb.addr + offset, src + offset, w, vec);
+        }
+        vec_end(vec, flags);
+        y += n;
+        h -= n;
+    }
+}
+
+void vbe_present(uint16_t *buf, vbe_rect_t *rect) {
+    vbe_rect_t r = *rect;
+    if (clip(&r))
+        copy_rows(buf, r.x, r.y, r.w, r.h);
+}
+
+void vbe_flush() {
+    if (!backbuffer)
+        return;
+    // The dirty rows are claimed with interrupts disabled, but copied with interrupts enabled.
+    // Areas marked in the meantime (e.g. by the timer IRQ, which flushes as well) are either
+    // copied by this call or left dirty for the next one.
+    uint32_t flags = irq_save();
+    int y = dirty_y0, y1 = dirty_y1;
+    dirty_y0 = dirty_y1 = 0;
+    irq_restore(flags);
+
+    while (y < y1) {
+        // Consecutive rows with the same span (e.g. full rows) are copied together
+        flags = irq_save();
+        uint_t x0 = dirty_x0[y], x1 = dirty_x1[y];
+        int end = y;
+        while (x0 < x1 && end < y1 && dirty_x0[end] == x0 && dirty_x1[end] == x1) {
+            dirty_x0[end] = dirty_x1[end] = 0;
+            end++;
+        }
+        irq_restore(flags);
+        if (end == y) {
+            y++;
+            continue;
+        }
+        copy_rows(backbuffer, x0, y, x1 - x0, end - y);
+        y = end;
+    }
+}
@@ -10,4 +10,32 @@ extern void vbe_setpixel(int x, int y, uint16_t color);
 extern uint16_t vbe_getpixel(int x, int y);
 extern void vbe_clear(uint16_t color);
 
+// The functions below clip the rectangle to the screen.
+
+// Fills the rectangle with the specified color.
+extern void vbe_fill_rect(vbe_rect_t *rect, uint16_t color);
+
+// Copies the buffer src into the rectangle.
+// src_pitch_in_pix is the length of a row of src in pixels.
+extern void vbe_blit(vbe_rect_t *rect, uint16_t *src, uint_t src_pitch_in_pix);
+
+// Copies the screen area located at (src_x,src_y) into the rectangle dst_rect.
+// Source and destination may overlap (e.g. scrolling).
+extern void vbe_copy_rect(vbe_rect_t *dst_rect, int src_x, int src_y);
+
+// Allocates a back buffer in RAM: from then on, all the functions above draw into it
+// and track the modified (dirty) areas, which are copied to the framebuffer by vbe_flush().
+// Returns false if the back buffer could not be allocated (drawing stays direct).
+// The back buffer belongs to the kernel: tasks drawing in buffered mode get their own
+// (see task_backbuffer).
+extern bool vbe_backbuffer_init();
+
+// Copies the dirty areas of the back buffer to the framebuffer.
+// Does nothing if there is no back buffer.
+extern void vbe_flush();
+
+// Copies the rectangle of buf, a buffer with the layout of the framebuffer (e.g. the back buffer
+// of a task), to the framebuffer.
+extern void vbe_present(uint16_t *buf, vbe_rect_t *rect);
+
 #endif
@@ -0,0 +1,154 @@
+#include "common/types.h"
+#include "common/cpu.h"
+#include "common/mem.h"
+#include "x86.h"
+#include "fpu.h"
+
+// Below this size, saving and restoring the SSE registers costs more than it saves
+#define FPU_MEM_MIN 4096
+
+// Large copies and fills are split into chunks of this size, so that interrupts
+// are not disabled for too long
+#define FPU_MEM_CHUNK (256*1024)
+
+static bool sse_enabled = false;
+
+// State right after initialization (fninit), given to new tasks
+static fpu_state_t initial_state;
+
+// State currently loaded in the registers (NULL if none): the registers are only saved
+// and reloaded when another task executes an FPU/SSE instruction (see fpu_handle_nm).
+static fpu_state_t *owner = NULL;
+
+// Copy of CR0.TS: when set, the next FPU/SSE instruction raises #NM
+static bool ts = false;
+
+// Registers of the owner while the kernel uses them
+static fpu_state_t kernel_scratch;
+
+// Statistics
+static uint_t task_switches = 0;
+static uint_t fpu_switches = 0;
+
+static void fxsave(fpu_state_t *state) {
+    asm volatile("fxsave %0" : "=m"(*state));
+}
+
+static void fxrstor(fpu_state_t *state) {
+    asm volatile("fxrstor %0" : : "m"(*state));
+}
+
+static void set_ts(bool value) {
+    if (value == ts)
+        return;
+    if (value)
+        write_cr0(read_cr0() | CR0_TS);
+    else
+        clts();
+    ts = value;
+}
+
+bool fpu_init() {
+    if (!cpu_has_sse2())
+        return false;
+    // No x87 emulation (EM), native x87 error reporting (NE), wait/fwait honors TS (MP)
+    write_cr0((read_cr0() & ~(CR0_EM | CR0_TS)) | CR0_MP | CR0_NE);
+    write_cr4(read_cr4() | CR4_OSFXSR | CR4_OSXMMEXCPT);
+    asm volatile("fninit");
+    fxsave(&initial_state);
+    sse_enabled = true;
+    return true;
+}
+
+bool fpu_sse_enabled() {
+    return sse_enabled;
+}
+
+void fpu_state_init(fpu_state_t *state) {
+    *state = initial_state;
+}
+
+void fpu_switch(fpu_state_t *next) {
+    task_switches++;
+    if (sse_enabled)
+        set_ts(!next || next != owner);
+}
+
+bool fpu_handle_nm(fpu_state_t *state) {
+    if (!sse_enabled)
+        return false;
+    set_ts(false);
+    if (owner != state) {
+        if (owner)
+            fxsave(owner);
+        fxrstor(state);
+        owner = state;
+        fpu_switches++;
+    }
+    return true;
+}
+
+void fpu_release(fpu_state_t *state) {
+    if (owner == state)
+        owner = NULL;
+}
+
+void fpu_stats(stats_fpu_t *stats) {
+    stats->enabled = sse_enabled;
+    stats->task_switches = task_switches;
+    stats->fpu_switches = fpu_switches;
+}
+
+// The registers are only saved if they hold the state of a task. The TS flag is restored
+// on exit, so that the lazy switching is not affected.
+static bool kernel_ts;
+
+uint32_t fpu_kernel_begin() {
+    uint32_t flags = irq_save();
+    kernel_ts = ts;
+    set_ts(false);
+    if (owner)
+        fxsave(&kernel_scratch);
+    return flags;
+}
+
+void fpu_kernel_end(uint32_t flags) {
+    if (owner)
+        fxrstor(&kernel_scratch);
+    set_ts(kernel_ts);
+    irq_restore(flags);
+}
+
+void fpu_memcpy(void *dst, void *src, uint_t count) {
+    if (!sse_enabled || count < FPU_MEM_MIN) {
+        memcpy(dst, src, count);
+        return;
+    }
+    uint8_t *d = dst;
+    uint8_t *s = src;
+    while (count) {
+        uint_t n = count < FPU_MEM_CHUNK ? count : FPU_MEM_CHUNK;
+        uint32_t flags = fpu_kernel_begin();
+        memcpy_sse2(d, s, n);
+        fpu_kernel_end(flags);
+        d += n;
+        s += n;
+        count -= n;
+    }
+}
+
+void fpu_memset(void *dst, uint8_t value, uint_t count) {
+    if (!sse_enabled || count < FPU_MEM_MIN) {
+        memset(dst, value, count);
+        return;
+    }
+    uint8_t *d = dst;
+    while (count) {
+        uint_t n = count < FPU_MEM_CHUNK ? count : FPU_MEM_CHUNK;
+        uint32_t flags = fpu_kernel_begin();
+        memfill_sse2(d, value * 0x01010101, n);
+        fpu_kernel_end(flags);
+        d += n;
+        count -= n;
+    }
+}
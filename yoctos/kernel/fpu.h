@@ -0,0 +1,52 @@
+#ifndef _FPU_H_
+#define _FPU_H_
+
+#include "common/types.h"
+#include "common/stats.h"
+
+// x87/MMX/SSE registers as saved by the fxsave instruction.
+typedef struct {
+    uint8_t data[512];
+} __attribute__((aligned(16))) fpu_state_t;
+
+// Enables SSE if the CPU supports SSE2 and FXSAVE/FXRSTOR.
+// Returns true if SSE was enabled.
+extern bool fpu_init();
+
+// Returns true if SSE is enabled.
+extern bool fpu_sse_enabled();
+
+// Initializes state with the default FPU/SSE state (the one of a new task).
+extern void fpu_state_init(fpu_state_t *state);
+
+// The FPU/SSE registers are switched lazily: when switching tasks, fpu_switch sets CR0.TS
+// unless the next task already owns the registers. The first FPU/SSE instruction of the
+// task then raises #NM, whose handler calls fpu_handle_nm to save the registers of the
+// previous owner and load the state of the task. Tasks that never use the FPU cost nothing.
+
+// Called when switching to the task whose state is next (NULL for the kernel).
+extern void fpu_switch(fpu_state_t *next);
+
+// Handles #NM raised by the task whose state is specified.
+// Returns false if the exception was not caused by the lazy switching (SSE disabled).
+extern bool fpu_handle_nm(fpu_state_t *state);
+
+// Called when a task is freed: its registers do not need to be saved anymore.
+extern void fpu_release(fpu_state_t *state);
+
+// Fills the FPU statistics.
+extern void fpu_stats(stats_fpu_t *stats);
+
+// The kernel itself never uses the FPU/SSE registers, since they hold the state of
+// a task. Code using them must be enclosed between fpu_kernel_begin and fpu_kernel_end,
+// which save and restore these registers (and CR0.TS) with interrupts disabled.
+// fpu_kernel_begin returns the flags to pass to fpu_kernel_end.
+// IMPORTANT: SSE must be enabled (see fpu_sse_enabled).
+extern uint32_t fpu_kernel_begin();
+extern void fpu_kernel_end(uint32_t flags);
+
+// Same as memcpy/memset but uses SSE2 for large areas, if SSE is enabled.
+extern void fpu_memcpy(void *dst, void *src, uint_t count);
+extern void fpu_memset(void *dst, uint8_t value, uint_t count);
+
+#endif
@@ -5,7 +5,9 @@
 #include "drivers/pic.h"
 #include "drivers/term.h"
 #include "mem/gdt.h"
+#include "mem/paging.h"
 #include "task/task.h"
+#include "fpu.h"
 #include "descriptors.h"
 #include "idt.h"
 #include "irq.h"
@@ -18,6 +20,18 @@
 #define LAST_EXCEPTION    20
 #define EXCEPTION_COUNT   (LAST_EXCEPTION-FIRST_EXCEPTION+1)
 
+// Device not available: raised by FPU/SSE instructions while CR0.TS is set
+#define EXCEPTION_NM      7
+
+// Double fault: handled by a task gate, i.e. on a stack of its own (see double_fault_handler)
+#define EXCEPTION_DF      8
+
+// Page fault: CR2 holds the faulting address, the error code tells whether the page was present
+// and whether the access was a write
+#define EXCEPTION_PF      14
+#define PF_PRESENT        (1 << 0)
+#define PF_WRITE          (1 << 1)
+
 // Reprograms the PIC to relocate hardware interrupts starting at IVT entry 32:
 // IRQ0  -> Interrupt 32
 // IRQ1  -> Interrupt 33
@@ -152,12 +166,21 @@ static char *exception_names[EXCEPTION_COUNT] = {
 
 // High-level handler for all exceptions.
 void exception_handler(regs_t *regs) {
-	uint16_t t = task_get_current_sel();
-	task_t* task = get_task_by_selector(t);
-	if (task->id >= 0 && task->id < MAX_TASK_COUNT){
-		uint8_t *addr_pt = regs->eip;
-		*addr_pt = 0xCF;
-		term_printf("Task %d terminated\n", task->id);
+	task_t *task = task_current();
+	// First FPU/SSE instruction of the task since it was switched to: loads its FPU state
+	if (regs->number == EXCEPTION_NM && (regs->cs & 3) == DPL_USER && task && fpu_handle_nm(&task->fpu))
+		return;
+	// First touch of a page of the task's heap or stack, or first write into a shared data page
+	if (regs->number == EXCEPTION_PF && task &&
+		task_page_fault(read_cr2(), regs->error_code & PF_PRESENT, regs->error_code & PF_WRITE))
+		return;
+	// Exception triggered by user code, or page fault of the kernel on an address of the task
+	// (e.g. a syscall writing into a read-only page of the task, or beyond the end of its heap):
+	// terminates the faulty task
+	bool task_fault = (regs->cs & 3) == DPL_USER || (regs->number == EXCEPTION_PF && task_owns_addr(read_cr2()));
+	if (task_fault && task) {
+		term_printf("Task %d terminated: %s\n", task->id, exception_names[regs->number]);
+		task_exit();
 	} else {
 		term_setfgcolor(YELLOW);
 		term_setbgcolor(RED);
@@ -167,6 +190,25 @@ void exception_handler(regs_t *regs) {
 	}
 }
 
+// TSS and stack of the double fault handler. A kernel stack overflow faults on the guard page
+// below the stack (see task.c), and again when the CPU pushes the exception frame onto it:
+// the resulting double fault can only be handled with a hardware task switch to another stack.
+static tss_t double_fault_tss;
+static uint8_t double_fault_stack[8192];
+
+static void double_fault_handler() {
+    uint32_t addr = read_cr2();
+    task_t *task = task_current();
+    term_setfgcolor(YELLOW);
+    term_setbgcolor(RED);
+    if (task_kstack_guard(addr))
+        term_printf("Kernel stack overflow in task %d (address 0x%x)!\n", task ? task->id : 0, addr);
+    else
+        term_printf("Exception %d triggered by kernel code: %s!\n", EXCEPTION_DF, exception_names[EXCEPTION_DF]);
+    term_printf("Kernel PANIC.\n");
+    halt();
+}
+
 // High-level handler for all hardware interrupts.
 void irq_handler(regs_t *regs) {
     uint_t irq = regs->number;
@@ -177,6 +219,10 @@ void irq_handler(regs_t *regs) {
         if (handler->func)
             handler->func();
     }
+
+    // Preemption point: it must come last as it may switch to another task.
+    if (irq == IRQ_TIMER)
+        task_tick((regs->cs & 3) == DPL_USER);
 }
 
 void idt_init() {
@@ -202,6 +248,19 @@ void idt_init() {
         idt[i] = idt_build_entry(GDT_KERNEL_CODE_SELECTOR, (uint32_t)exceptions[i], TYPE_INTERRUPT_GATE, DPL_KERNEL);
     }
 
+    // Double faults switch to the task of double_fault_handler, with interrupts disabled
+    extern gdt_entry_t *gdt_double_fault_tss;
+    memset(&double_fault_tss, 0, sizeof(tss_t));
+    double_fault_tss.cs = GDT_KERNEL_CODE_SELECTOR;
+    double_fault_tss.ds = double_fault_tss.es = double_fault_tss.fs = double_fault_tss.gs = double_fault_tss.ss = GDT_KERNEL_DATA_SELECTOR;
+    double_fault_tss.cr3 = (uint32_t)paging_get_current_pagedir();
+    double_fault_tss.eflags = 0x2;
+    double_fault_tss.eip = (uint32_t)double_fault_handler;
+    double_fault_tss.esp = (uint32_t)double_fault_stack + sizeof(double_fault_stack);
+    double_fault_tss.iomap_base_addr = sizeof(tss_t);
+    *gdt_double_fault_tss = gdt_make_tss(&double_fault_tss, sizeof(tss_t), DPL_KERNEL);
+    idt[EXCEPTION_DF] = idt_build_entry(gdt_entry_to_selector(gdt_double_fault_tss), 0, TYPE_TASK_GATE, DPL_KERNEL);
+
     // IDT entries 32-47: hardware interrupts.
     // Creates interrupt handlers for IRQ0-15.
     // These handlers are located at indices 32-47 in the IVT.
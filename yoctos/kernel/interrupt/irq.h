@@ -6,6 +6,9 @@
 #define IRQ_FIRST    0
 #define IRQ_LAST     15
 
+#define IRQ_TIMER    0
+#define IRQ_KEYBOARD 1
+
 typedef struct {
     void (*func)(void);
     char name[64];
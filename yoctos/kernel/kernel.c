@@ -2,6 +2,7 @@
 #include "common/stdio.h"
 #include "common/mem.h"
 #include "common/keycodes.h"
+#include "common/vdso.h"
 #include "boot/module.h"
 #include "boot/multiboot.h"
 #include "drivers/vbe.h"
@@ -12,9 +13,12 @@
 #include "interrupt/idt.h"
 #include "mem/paging.h"
 #include "mem/frame.h"
+#include "mem/kmalloc.h"
 #include "mem/gdt.h"
 #include "task/task.h"
+#include "syscall/syscall.h"
 #include "x86.h"
+#include "fpu.h"
 
 // These are defined in the linker script: kernel.ld
 extern void ld_kernel_start();
@@ -28,6 +32,10 @@ void kernel_main(multiboot_info_t *mbi) {
 
     gdt_init();
 
+    // The kernel keeps the default memory functions (see fpu.h): only the code
+    // enclosed in fpu_kernel_begin/end uses SSE.
+    bool sse = fpu_init();
+
     // This function must be initialized first! (before using any term_xxx functions!)
     vbe_init();
     vbe_fb_t *fb = vbe_get_fb();
@@ -36,7 +44,10 @@ void kernel_main(multiboot_info_t *mbi) {
 
     term_init();
     term_printf("YoctOS started\n");
+    if (vbe_backbuffer_init())
+        term_printf("VBE back buffer enabled (%dKB).\n", fb->size/1024);
     term_printf("VBE mode %dx%d %dbpp initialized (addr=0x%x, pitch=%d).\n", fb->width, fb->height, fb->bpp, fb->addr, fb->pitch_in_bytes);
+    term_printf("SSE %s.\n", sse ? "enabled" : "not supported");
     term_printf("Detected %dKB of RAM.\n", RAM_in_KB);
     term_printf("%dKB of RAM available.\n", frame_total_free()*FRAME_SIZE/1024);
     term_printf("Kernel loaded at [0x%x-0x%x], size=%dKB\n", kernel_start, kernel_end, (kernel_end-kernel_start)/1024);
@@ -46,17 +57,41 @@ void kernel_main(multiboot_info_t *mbi) {
     pic_init();
     idt_init();
     keyb_init();
-	tasks_init();
 
     // IMPORTANT: timer frequency must be >= 50
     int timer_freq = 1000;
     timer_init(timer_freq);
+    // Lets user space use SSE (see ulibc_init)
+    if (sse)
+        timer_get_vdso()->features |= VDSO_FEATURE_SSE;
+
+    tasks_init();  // must be called AFTER timer_init()!
+    syscall_init();
 
     // Unmask hardware interrupts
     sti();
     term_puts("Interrupts enabled.\n");
 
-	task_exec("shell.exe", 0, NULL);
+	if (task_spawn("shell.exe", 0, NULL) < 0)
+        term_printf("Failed executing \"shell.exe\"\n");
+
+    // Idle loop: runs the ready tasks and halts the CPU until the next interrupt
+    // whenever none is ready.
+    // Before halting, the idle time is used to zero free frames in advance, one at a time
+    // with interrupts enabled, so that a task woken up meanwhile runs right away.
+    cli();
+    while (task_count() > 0) {
+        task_schedule();
+        sti();
+        bool refilled = frame_pool_refill();
+        cli();
+        if (!refilled)
+            idle_wait();
+    }
+    task_schedule();  // frees the tasks that exited last
+
+    // Every task is gone: what the kernel heap still holds is either permanent or leaked
+    kmalloc_report();
 
     term_printf("\nSystem halted.");
     halt();
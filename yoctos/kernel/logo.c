@@ -32,4 +32,5 @@ void logo_render() {
         if (timer_get_ticks() % delay == 0)
             pos[i] = (pos[i] + 1) % WIDTH;
     }
+    vbe_flush();
 }
@@ -0,0 +1,260 @@
+#include "common/types.h"
+#include "common/mem.h"
+#include "boot/module.h"
+#include "boot/multiboot.h"
+#include "paging.h"
+#include "frame.h"
+
+// Buddy allocator: the free frames are grouped into blocks of 2^order frames, aligned on their
+// size. A block of order n is split into two "buddies" of order n-1 to satisfy a smaller request,
+// and a freed block is merged with its buddy whenever the buddy is free as well.
+
+#define NO_FRAME 0xFFFFFFFF
+
+// State of a frame. order and free are only meaningful for the first frame of a free block.
+typedef struct {
+    uint32_t next;   // next/previous block in the free list of its order (NO_FRAME if none)
+    uint32_t prev;
+    uint16_t refs;   // reference count (0 for free frames and frames not returned by the allocator)
+    uint8_t order;   // order of the free block starting at this frame
+    uint8_t free;    // whether a free block starts at this frame
+} frame_info_t;
+
+// Array of total_frames entries, located in the frames right after the modules (see frame_init)
+static frame_info_t *frames;
+static uint_t total_frames;
+static uint_t free_frames;  // kept up to date so that frame_total_free() is cheap (page faults)
+
+// First block of each free list
+static uint32_t free_list[FRAME_MAX_ORDER + 1];
+static uint_t free_blocks[FRAME_MAX_ORDER + 1];
+
+// Pool of free frames zeroed in advance by the idle loop (see frame_pool_refill).
+// These frames are allocated from the buddy allocator's point of view.
+static void *pool[FRAME_POOL_SIZE];
+static uint_t pool_count = 0;
+static uint_t pool_hits = 0;    // frame_alloc() calls served by the pool
+static uint_t pool_misses = 0;  // frame_alloc() calls that had to zero a frame
+
+static void list_push(uint32_t n, uint_t order) {
+    frames[n].order = order;
+    frames[n].free = true;
+    frames[n].prev = NO_FRAME;
+    frames[n].next = free_list[order];
+    if (free_list[order] != NO_FRAME)
+        frames[free_list[order]].prev = n;
+    free_list[order] = n;
+    free_blocks[order]++;
+}
+
+static void list_remove(uint32_t n) {
+    uint_t order = frames[n].order;
+    if (frames[n].prev != NO_FRAME)
+        frames[frames[n].prev].next = frames[n].next;
+    else
+        free_list[order] = frames[n].next;
+    if (frames[n].next != NO_FRAME)
+        frames[frames[n].next].prev = frames[n].prev;
+    frames[n].free = false;
+    free_blocks[order]--;
+}
+
+// Frees the block of 2^order frames starting at frame n, merging it with its free buddies.
+static void free_block(uint32_t n, uint_t order) {
+    free_frames += 1 << order;
+    while (order < FRAME_MAX_ORDER) {
+        uint32_t buddy = n ^ (1 << order);
+        if (buddy >= total_frames || !frames[buddy].free || frames[buddy].order != order)
+            break;
+        list_remove(buddy);
+        n &= ~(1 << order);
+        order++;
+    }
+    list_push(n, order);
+}
+
+// Frees the frames [first, end) as the largest aligned blocks possible.
+static void free_range(uint32_t first, uint32_t end) {
+    while (first < end) {
+        uint_t order = 0;
+        while (order < FRAME_MAX_ORDER && !(first & (1 << order)) && first + (2 << order) <= end)
+            order++;
+        free_block(first, order);
+        first += 1 << order;
+    }
+}
+
+// Allocates a block of 2^order frames. Returns its first frame or NO_FRAME.
+static uint32_t alloc_block(uint_t order) {
+    uint_t k = order;
+    while (k <= FRAME_MAX_ORDER && free_list[k] == NO_FRAME)
+        k++;
+    if (k > FRAME_MAX_ORDER)
+        return NO_FRAME;
+
+    uint32_t n = free_list[k];
+    list_remove(n);
+    // Returns the upper halves to the free lists until the block has the requested size
+    while (k > order) {
+        k--;
+        list_push(n + (1 << k), k);
+    }
+    free_frames -= 1 << order;
+    for (uint32_t i = n; i < n + (1 << order); i++)
+        frames[i].refs = 1;
+    return n;
+}
+
+// Gives the frames of the pool back to the buddy allocator, so that they can be part of a block.
+// Like any free frame, they are not referenced anymore (see frame_free).
+static void pool_drain() {
+    while (pool_count) {
+        uint32_t n = ADDR_TO_FRAME_NB(pool[--pool_count]);
+        frames[n].refs = 0;
+        free_block(n, 0);
+    }
+}
+
+// Allocates a block of 2^order frames, draining the pool if no block is available.
+static uint32_t alloc_block_drain(uint_t order) {
+    uint32_t n = alloc_block(order);
+    if (n == NO_FRAME && pool_count) {
+        pool_drain();
+        n = alloc_block(order);
+    }
+    return n;
+}
+
+void *frame_alloc() {
+    if (pool_count) {
+        pool_hits++;
+        return pool[--pool_count];
+    }
+    pool_misses++;
+    uint32_t n = alloc_block(0);
+    if (n == NO_FRAME)
+        return (void *)0xFFFFFFFF;
+    void *addr = (void *)FRAME_NB_TO_ADDR(n);
+    memsetdw(addr, 0, FRAME_SIZE/4);
+    return addr;
+}
+
+bool frame_pool_refill() {
+    if (pool_count == FRAME_POOL_SIZE)
+        return false;
+    uint32_t n = alloc_block(0);
+    if (n == NO_FRAME)
+        return false;
+    void *addr = (void *)FRAME_NB_TO_ADDR(n);
+    memsetdw(addr, 0, FRAME_SIZE/4);
+    pool[pool_count++] = addr;
+    return true;
+}
+
+void *frame_alloc_block(uint_t order) {
+    if (order > FRAME_MAX_ORDER)
+        return (void *)0xFFFFFFFF;
+    uint32_t n = alloc_block_drain(order);
+    if (n == NO_FRAME)
+        return (void *)0xFFFFFFFF;
+    void *addr = (void *)FRAME_NB_TO_ADDR(n);
+    memsetdw(addr, 0, (FRAME_SIZE << order)/4);
+    return addr;
+}
+
+void *frame_alloc_contiguous(uint_t count) {
+    uint_t order = 0;
+    while ((1u << order) < count)
+        order++;
+    if (!count || order > FRAME_MAX_ORDER)
+        return (void *)0xFFFFFFFF;
+
+    uint32_t n = alloc_block_drain(order);
+    if (n == NO_FRAME)
+        return (void *)0xFFFFFFFF;
+    // The frames beyond count are given back right away
+    for (uint32_t i = n + count; i < n + (1 << order); i++)
+        frames[i].refs = 0;
+    free_range(n + count, n + (1 << order));
+
+    void *addr = (void *)FRAME_NB_TO_ADDR(n);
+    memsetdw(addr, 0, count*FRAME_SIZE/4);
+    return addr;
+}
+
+void frame_free(void *frame_addr) {
+    uint32_t n = ADDR_TO_FRAME_NB(frame_addr);
+    // Frames not returned by the allocator (kernel, modules, framebuffer) are ignored
+    if (n >= total_frames || !frames[n].refs)
+        return;
+    if (--frames[n].refs == 0)
+        free_block(n, 0);
+}
+
+void frame_free_block(void *frame_addr, uint_t order) {
+    uint32_t n = ADDR_TO_FRAME_NB(frame_addr);
+    for (uint32_t i = n; i < n + (1 << order); i++)
+        frames[i].refs = 0;
+    free_block(n, order);
+}
+
+void frame_ref(void *frame_addr) {
+    uint32_t n = ADDR_TO_FRAME_NB(frame_addr);
+    if (n < total_frames && frames[n].refs)
+        frames[n].refs++;
+}
+
+uint_t frame_refcount(void *frame_addr) {
+    uint32_t n = ADDR_TO_FRAME_NB(frame_addr);
+    return n < total_frames ? frames[n].refs : 0;
+}
+
+uint_t frame_total_free() {
+    return free_frames + pool_count;
+}
+
+void frame_stats(stats_frames_t *stats) {
+    stats->total = total_frames;
+    stats->free = free_frames + pool_count;
+    stats->pool_frames = pool_count;
+    stats->pool_hits = pool_hits;
+    stats->pool_misses = pool_misses;
+    stats->largest_free_order = 0;
+    for (uint_t order = 0; order <= FRAME_MAX_ORDER; order++) {
+        stats->free_blocks[order] = free_blocks[order];
+        if (free_blocks[order])
+            stats->largest_free_order = order;
+    }
+}
+
+void frame_init(uint_t RAM_in_KB) {
+    total_frames = RAM_in_KB/4;
+    for (uint_t order = 0; order <= FRAME_MAX_ORDER; order++) {
+        free_list[order] = NO_FRAME;
+        free_blocks[order] = 0;
+    }
+
+    // The frames used by the kernel and the modules (located right after it),
+    // followed by the state of the frames, are never freed
+    uint32_t used = ADDR_TO_FRAME_NB(modules_last_address() + FRAME_SIZE);
+    frames = (frame_info_t *)FRAME_NB_TO_ADDR(used);
+    memset(frames, 0, total_frames * sizeof(frame_info_t));
+    used += FRAME_COUNT(total_frames * sizeof(frame_info_t));
+
+    // Nor are the frames of the VBE framebuffer, if it is located in RAM
+    multiboot_info_t *mbi = multiboot_get_info();
+    uint32_t fb_first = ADDR_TO_FRAME_NB((uint32_t)mbi->framebuffer_addr);
+    uint32_t fb_end = fb_first + FRAME_COUNT(mbi->framebuffer_pitch * mbi->framebuffer_height);
+    if (fb_first > total_frames)
+        fb_first = total_frames;
+    if (fb_end > total_frames)
+        fb_end = total_frames;
+
+    free_frames = 0;
+    if (fb_end <= used || fb_first >= total_frames) {
+        free_range(used, total_frames);
+    } else {
+        free_range(used, fb_first > used ? fb_first : used);
+        free_range(fb_end, total_frames);
+    }
+}
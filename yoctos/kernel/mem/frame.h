@@ -2,6 +2,8 @@
 #define _FRAME_H_
 
 #include "common/types.h"
+#include "common/stats.h"
+#include "common/kbench.h"
 
 // The hardware supports 3 frame sizes: 4KB, 4MB and 2MB (when PAE is enabled)
 // Our kernel only uses 4KB frames.
@@ -16,6 +18,12 @@
 // Returns the number of frames required to store the given number of bytes
 #define FRAME_COUNT(size) ((size + FRAME_SIZE - 1)/FRAME_SIZE)
 
+// Largest block handed out by the buddy allocator: 2^10 frames (4MB)
+#define FRAME_MAX_ORDER  STATS_FRAME_MAX_ORDER
+
+// Maximum number of pre-zeroed frames kept for frame_alloc (see frame_pool_refill)
+#define FRAME_POOL_SIZE  256
+
 // Initializes the physical frame subsystem, using the specified amount of physical memory.
 extern void frame_init(uint_t RAM_in_KB);
 
@@ -24,15 +32,50 @@ extern void frame_init(uint_t RAM_in_KB);
 // 0xFFFFFFFF if no more frames are available.
 // REMARKS:
 // The physical address is always aligned to a 4KB boundary.
-// The frame's content is always zeroed.
+// The frame's content is always zeroed and its reference count is 1.
+// Frames are taken from the pool of pre-zeroed frames first (see frame_pool_refill).
 extern void *frame_alloc();
 
-// Free a frame.
-// REMARK: doesn't check whether the frame was previously allocated or not.
+// Zeroes one free frame and adds it to the pool used by frame_alloc, so that allocations do
+// not have to zero frames themselves. Meant to be called by the idle loop.
+// Returns false if the pool is full (or there is no free frame left).
+extern bool frame_pool_refill();
+
+// Allocates a block of 2^order physically contiguous frames (order <= FRAME_MAX_ORDER), aligned
+// on its size (e.g. order 10 for a 4MB page). Returns the physical address of the first frame
+// or 0xFFFFFFFF if no such block is available.
+// The frames' content is always zeroed and their reference counts are 1.
+extern void *frame_alloc_block(uint_t order);
+
+// Frees a block returned by frame_alloc_block, regardless of the reference counts of its frames.
+extern void frame_free_block(void *frame_addr, uint_t order);
+
+// Allocates count (up to 2^FRAME_MAX_ORDER) physically contiguous frames and returns the physical
+// address of the first one. Returns 0xFFFFFFFF if no such range is available.
+// The frames' content is always zeroed and they can be freed one by one with frame_free.
+extern void *frame_alloc_contiguous(uint_t count);
+
+// Releases a reference to a frame: the frame is freed once its last reference is released.
+// Frames that were not returned by the allocator (e.g. kernel, modules) are ignored.
 extern void frame_free(void *frame_addr);
 
-// Returns the total number of free frames.
+// Adds a reference to a frame returned by frame_alloc (e.g. the frame is mapped by one more
+// page directory), so that it is only freed by the last call to frame_free.
+// Frames not returned by the allocator (kernel, modules, framebuffer) are ignored.
+extern void frame_ref(void *frame_addr);
+
+// Returns the number of references to a frame (0 if it was not returned by the allocator).
+extern uint_t frame_refcount(void *frame_addr);
+
+// Returns the total number of free frames (including the frames of the pool).
 // This can typically be used by a syscall to retrieve the amount of free RAM.
 extern uint_t frame_total_free();
 
+// Fills the allocator statistics (free blocks of each order).
+extern void frame_stats(stats_frames_t *stats);
+
+// Measures the throughput of the frame allocator.
+// Implemented in frame_bench.c
+extern void frame_bench(uint_t count, kbench_frames_t *res);
+
  #endif
@@ -0,0 +1,72 @@
+#include "common/types.h"
+#include "common/cpu.h"
+#include "common/kbench.h"
+#include "x86.h"
+#include "frame.h"
+
+// Stress benchmark of the frame allocator: allocations and frees of single frames, then of blocks
+// of various sizes kept for a while and freed in random order (which fragments the free memory).
+
+#define BENCH_SLOTS 64
+#define BENCH_MAX_ORDER 4  // blocks of up to 16 frames
+
+static void *slots[BENCH_SLOTS];
+static uint8_t slot_orders[BENCH_SLOTS];
+
+// Linear congruential generator (numerical recipes constants)
+static uint32_t bench_seed;
+static uint32_t bench_rand() {
+    bench_seed = bench_seed * 1664525 + 1013904223;
+    return bench_seed >> 16;
+}
+
+void frame_bench(uint_t count, kbench_frames_t *res) {
+    if (count == 0)
+        count = 1;
+
+    // The allocator is not thread-safe: the timer must not schedule another task meanwhile
+    uint32_t flags = irq_save();
+
+    // frame_alloc would empty the pool of pre-zeroed frames (which frame_free does not refill)
+    // and skew its statistics: the buddy allocator is measured directly
+    uint64_t start = rdtsc();
+    for (uint_t i = 0; i < count; i++) {
+        void *frame = frame_alloc_block(0);
+        if (frame != (void *)0xFFFFFFFF)
+            frame_free_block(frame, 0);
+    }
+    res->single = (rdtsc() - start) / count;
+
+    bench_seed = 1;
+    res->failures = 0;
+    for (uint_t i = 0; i < BENCH_SLOTS; i++)
+        slots[i] = NULL;
+    start = rdtsc();
+    for (uint_t i = 0; i < count; i++) {
+        uint_t s = bench_rand() % BENCH_SLOTS;
+        if (slots[s]) {
+            frame_free_block(slots[s], slot_orders[s]);
+            slots[s] = NULL;
+        } else {
+            slot_orders[s] = bench_rand() % (BENCH_MAX_ORDER + 1);
+            slots[s] = frame_alloc_block(slot_orders[s]);
+            if (slots[s] == (void *)0xFFFFFFFF) {
+                slots[s] = NULL;
+                res->failures++;
+            }
+        }
+    }
+    // Every iteration either allocates or frees a block: about count/2 pairs
+    res->mixed = (rdtsc() - start) * 2 / count;
+
+    stats_frames_t stats;
+    frame_stats(&stats);
+    res->largest_free_order = stats.largest_free_order;
+
+    for (uint_t i = 0; i < BENCH_SLOTS; i++) {
+        if (slots[i])
+            frame_free_block(slots[i], slot_orders[i]);
+    }
+
+    irq_restore(flags);
+}
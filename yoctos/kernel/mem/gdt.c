@@ -1,6 +1,5 @@
 #include "common/types.h"
 #include "common/mem.h"
-#include "task/task.h"
 #include "gdt.h"
 #include "descriptors.h"
 
@@ -33,13 +32,16 @@ extern void gdt_load(gdt_ptr_t *gdt_ptr);
 //   2: kernel data
 //   3: user code
 //   4: user data
-static gdt_entry_t gdt[KERNEL_TSS_INDEX+1+MAX_TASK_COUNT];
+static gdt_entry_t gdt[KERNEL_TSS_INDEX+3];
 static gdt_ptr_t gdt_ptr;
 
-// Entries from index 5 on are used to store tasks' TSS (see task.c),
-// starting with the initial TSS for the kernel.
-gdt_entry_t *gdt_initial_tss = &gdt[KERNEL_TSS_INDEX];
-gdt_entry_t *gdt_first_task_entry = &gdt[KERNEL_TSS_INDEX+1];
+// Entry 5 stores the TSS shared by the kernel and all tasks (see task.c).
+// Tasks are switched in software, hence they don't need a TSS of their own.
+gdt_entry_t *gdt_kernel_tss = &gdt[KERNEL_TSS_INDEX];
+// Entry 6 stores the TSS used to benchmark hardware task switching (see task_bench.c).
+gdt_entry_t *gdt_bench_tss = &gdt[KERNEL_TSS_INDEX+1];
+// Entry 7 stores the TSS of the double fault handler (see idt.c).
+gdt_entry_t *gdt_double_fault_tss = &gdt[KERNEL_TSS_INDEX+2];
 
 // Build and return a GDT entry.
 // base is the base of the segment
@@ -86,10 +88,11 @@ static gdt_entry_t gdt_make_data_segment(uint32_t base, uint32_t limit, uint8_t
     return build_entry(base, limit, TYPE_DATA_RW, S_CODE_OR_DATA, DB_SEG, 1, dpl);
 }
 
-// Return a TSS entry  specified by the TSS structure and privilege level passed in arguments.
+// Return a TSS entry  specified by the TSS structure, its size (IO permission bitmap included)
+// and privilege level passed in arguments.
 // NOTE: a TSS entry can only reside in the GDT!
-gdt_entry_t gdt_make_tss(tss_t *tss, uint8_t dpl) {
-    return build_entry((uint32_t)tss, sizeof(tss_t)-1, TYPE_TSS, S_SYSTEM, DB_SYS, 0, dpl);
+gdt_entry_t gdt_make_tss(tss_t *tss, uint_t size, uint8_t dpl) {
+    return build_entry((uint32_t)tss, size-1, TYPE_TSS, S_SYSTEM, DB_SYS, 0, dpl);
 }
 
 // Return the selector of an entry in the GDT
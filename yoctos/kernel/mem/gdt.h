@@ -38,6 +38,6 @@ typedef struct gdt_entry_st {
 
 extern void gdt_init();
 extern uint_t gdt_entry_to_selector(gdt_entry_t *entry);
-extern gdt_entry_t gdt_make_tss(tss_t *tss, uint8_t dpl);
+extern gdt_entry_t gdt_make_tss(tss_t *tss, uint_t size, uint8_t dpl);
 
 #endif
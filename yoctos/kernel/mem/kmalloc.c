@@ -0,0 +1,263 @@
+#include "common/types.h"
+#include "common/mem.h"
+#include "drivers/term.h"
+#include "x86.h"
+#include "frame.h"
+#include "kmalloc.h"
+
+// A slab is a frame holding a header followed by objects of a single size class.
+// Its free objects are chained through their first bytes.
+// Slabs with free objects are kept in the list of their class; full slabs are in no list.
+// Allocations larger than the largest class are served by whole contiguous frames, starting
+// with a header as well: the header of any allocation is thus found at the start of its frame.
+
+#define SLAB_MAGIC   0x42414C53  // "SLAB"
+#define LARGE_MAGIC  0x4752414C  // "LARG"
+
+// Size of the headers, which keeps the objects aligned on 16 bytes
+#define HEADER_SIZE  32
+
+#define CLASS_COUNT  STATS_KMALLOC_CLASSES
+#define MIN_SIZE     16
+#define MAX_SIZE     (MIN_SIZE << (CLASS_COUNT - 1))
+
+#define FRAME_OF(ptr) ((void *)((uint32_t)(ptr) & ~(FRAME_SIZE - 1)))
+
+typedef struct free_obj_st {
+    struct free_obj_st *next;
+} free_obj_t;
+
+typedef struct slab_st {
+    uint32_t magic;
+    uint16_t cls;             // size class of the objects
+    uint16_t used;            // objects currently allocated
+    free_obj_t *free;         // first free object (NULL if the slab is full)
+    struct slab_st *next;     // next/previous slab with free objects in the same class
+    struct slab_st *prev;
+} slab_t;
+
+typedef struct large_st {
+    uint32_t magic;
+    uint32_t frames;          // frames of the allocation, header included
+    void *caller;             // address kmalloc was called from (see kmalloc_report)
+    struct large_st *next;    // next/previous live large allocation
+    struct large_st *prev;
+} large_t;
+
+typedef struct {
+    slab_t *partial;          // slabs with free objects
+    slab_t *empty;            // empty slab kept to avoid freeing/allocating a frame back and forth
+    uint_t in_use;
+    uint_t slabs;
+    uint_t allocs;
+} size_class_t;
+
+static size_class_t classes[CLASS_COUNT];
+static large_t *large_list = NULL;
+static uint_t large_in_use = 0;
+static uint_t large_frames = 0;
+static uint_t failures = 0;
+
+static void kmalloc_panic(char *msg, void *ptr) {
+    term_setcolors((term_colors_t){ RGB(255,100,100), RGB(50,50,50) });
+    term_printf("KERNEL PANIC: %s (0x%x)\n", msg, ptr);
+    halt();
+}
+
+static uint_t class_size(uint_t cls) {
+    return MIN_SIZE << cls;
+}
+
+static void list_push(size_class_t *c, slab_t *slab) {
+    slab->prev = NULL;
+    slab->next = c->partial;
+    if (c->partial)
+        c->partial->prev = slab;
+    c->partial = slab;
+}
+
+static void list_remove(size_class_t *c, slab_t *slab) {
+    if (slab->prev)
+        slab->prev->next = slab->next;
+    else
+        c->partial = slab->next;
+    if (slab->next)
+        slab->next->prev = slab->prev;
+}
+
+// Allocates a new slab for the class cls and chains all its objects.
+static slab_t *slab_create(uint_t cls) {
+    slab_t *slab = frame_alloc();
+    if (slab == (slab_t *)0xFFFFFFFF)
+        return NULL;
+    uint_t size = class_size(cls);
+    slab->magic = SLAB_MAGIC;
+    slab->cls = cls;
+    slab->used = 0;
+    slab->free = NULL;
+    // Chained backwards so that the objects are handed out in address order
+    for (uint8_t *obj = (uint8_t *)slab + HEADER_SIZE + ((FRAME_SIZE - HEADER_SIZE)/size - 1)*size;
+         obj >= (uint8_t *)slab + HEADER_SIZE; obj -= size) {
+        ((free_obj_t *)obj)->next = slab->free;
+        slab->free = (free_obj_t *)obj;
+    }
+    classes[cls].slabs++;
+    return slab;
+}
+
+static void *slab_alloc(uint_t cls) {
+    size_class_t *c = &classes[cls];
+    slab_t *slab = c->partial;
+    if (!slab) {
+        slab = slab_create(cls);
+        if (!slab)
+            return NULL;
+        list_push(c, slab);
+    }
+    if (slab == c->empty)
+        c->empty = NULL;
+
+    free_obj_t *obj = slab->free;
+    slab->free = obj->next;
+    slab->used++;
+    if (!slab->free)
+        list_remove(c, slab);
+    c->in_use++;
+    c->allocs++;
+    return obj;
+}
+
+static void slab_free(slab_t *slab, void *ptr) {
+    size_class_t *c = &classes[slab->cls];
+    uint32_t offset = (uint32_t)ptr - (uint32_t)slab;
+    if (offset < HEADER_SIZE || (offset - HEADER_SIZE) % class_size(slab->cls))
+        kmalloc_panic("kfree(): pointer not returned by kmalloc", ptr);
+
+    if (!slab->free)
+        list_push(c, slab);
+    free_obj_t *obj = ptr;
+    obj->next = slab->free;
+    slab->free = obj;
+    slab->used--;
+    c->in_use--;
+
+    // One empty slab is kept per class, the others are given back to the frame allocator
+    if (slab->used == 0) {
+        if (!c->empty) {
+            c->empty = slab;
+        } else {
+            list_remove(c, slab);
+            slab->magic = 0;
+            frame_free(slab);
+            c->slabs--;
+        }
+    }
+}
+
+static void *large_alloc(uint_t size, void *caller) {
+    uint_t count = FRAME_COUNT(size + HEADER_SIZE);
+    large_t *large = frame_alloc_contiguous(count);
+    if (large == (large_t *)0xFFFFFFFF)
+        return NULL;
+    large->magic = LARGE_MAGIC;
+    large->frames = count;
+    large->caller = caller;
+    large->prev = NULL;
+    large->next = large_list;
+    if (large_list)
+        large_list->prev = large;
+    large_list = large;
+    large_in_use++;
+    large_frames += count;
+    return (uint8_t *)large + HEADER_SIZE;
+}
+
+static void large_free(large_t *large, void *ptr) {
+    if ((uint8_t *)ptr != (uint8_t *)large + HEADER_SIZE)
+        kmalloc_panic("kfree(): pointer not returned by kmalloc", ptr);
+    if (large->prev)
+        large->prev->next = large->next;
+    else
+        large_list = large->next;
+    if (large->next)
+        large->next->prev = large->prev;
+    large_in_use--;
+    large_frames -= large->frames;
+
+    uint_t count = large->frames;
+    large->magic = 0;
+    for (uint_t i = 0; i < count; i++)
+        frame_free((uint8_t *)large + i*FRAME_SIZE);
+}
+
+// caller is recorded in large allocations: kmalloc and kzalloc both pass their own caller.
+static void *do_kmalloc(uint_t size, void *caller) {
+    if (size == 0)
+        size = 1;
+    uint32_t flags = irq_save();
+    void *ptr;
+    if (size > MAX_SIZE) {
+        ptr = large_alloc(size, caller);
+    } else {
+        uint_t cls = 0;
+        while (class_size(cls) < size)
+            cls++;
+        ptr = slab_alloc(cls);
+    }
+    if (!ptr)
+        failures++;
+    irq_restore(flags);
+    return ptr;
+}
+
+void *kmalloc(uint_t size) {
+    return do_kmalloc(size, __builtin_return_address(0));
+}
+
+void *kzalloc(uint_t size) {
+    void *ptr = do_kmalloc(size, __builtin_return_address(0));
+    if (ptr)
+        memset(ptr, 0, size);
+    return ptr;
+}
+
+void kfree(void *ptr) {
+    if (!ptr)
+        return;
+    uint32_t flags = irq_save();
+    // A pointer at the very start of a frame cannot have been returned by kmalloc
+    void *frame = FRAME_OF(ptr);
+    uint32_t magic = frame != ptr ? *(uint32_t *)frame : 0;
+    if (magic == SLAB_MAGIC)
+        slab_free(frame, ptr);
+    else if (magic == LARGE_MAGIC)
+        large_free(frame, ptr);
+    else
+        kmalloc_panic("kfree(): pointer not returned by kmalloc", ptr);
+    irq_restore(flags);
+}
+
+void kmalloc_stats(stats_kmalloc_t *stats) {
+    for (uint_t i = 0; i < CLASS_COUNT; i++) {
+        stats->classes[i].size = class_size(i);
+        stats->classes[i].in_use = classes[i].in_use;
+        stats->classes[i].slabs = classes[i].slabs;
+        stats->classes[i].allocs = classes[i].allocs;
+    }
+    stats->large_in_use = large_in_use;
+    stats->large_frames = large_frames;
+    stats->failures = failures;
+}
+
+uint_t kmalloc_report() {
+    uint_t live = large_in_use;
+    for (uint_t i = 0; i < CLASS_COUNT; i++) {
+        if (classes[i].in_use)
+            term_printf("kmalloc: %d objects of %d bytes still allocated\n", classes[i].in_use, class_size(i));
+        live += classes[i].in_use;
+    }
+    for (large_t *large = large_list; large; large = large->next)
+        term_printf("kmalloc: %dKB at 0x%x still allocated (caller 0x%x)\n", large->frames*FRAME_SIZE/1024,
+                    (uint8_t *)large + HEADER_SIZE, large->caller);
+    return live;
+}
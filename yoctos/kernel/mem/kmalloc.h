@@ -0,0 +1,29 @@
+#ifndef _KMALLOC_H_
+#define _KMALLOC_H_
+
+#include "common/types.h"
+#include "common/stats.h"
+
+// Kernel heap: small objects are carved out of slabs (one frame each) of fixed size classes
+// (16 to 1024 bytes), larger ones get their own physically contiguous frames.
+// Memory is taken from the frame allocator on demand and slabs are given back once empty.
+
+// Allocates size bytes and returns their (kernel) address or NULL if no memory is available.
+// The memory is aligned on 16 bytes but its content is undefined.
+extern void *kmalloc(uint_t size);
+
+// Same as kmalloc, with the memory zeroed.
+extern void *kzalloc(uint_t size);
+
+// Frees memory returned by kmalloc/kzalloc. NULL is ignored.
+extern void kfree(void *ptr);
+
+// Fills the kernel heap statistics.
+extern void kmalloc_stats(stats_kmalloc_t *stats);
+
+// Prints the allocations that have not been freed yet: the objects still allocated in each
+// size class and every large allocation along with its caller.
+// Returns the number of live allocations.
+extern uint_t kmalloc_report();
+
+#endif
@@ -0,0 +1,338 @@
+#include "common/types.h"
+#include "common/mem.h"
+#include "common/colors.h"
+#include "common/cpu.h"
+#include "drivers/term.h"
+#include "drivers/vbe.h"
+#include "x86.h"
+#include "paging.h"
+#include "frame.h"
+
+// Page directory of the kernel
+static PDE_t kernel_pagedir[PAGETABLES_IN_PD] __attribute__((aligned(4096)));
+
+// Whether 4MB pages are enabled (CR4.PSE)
+static bool large_pages = false;
+
+// Whether global pages are enabled (CR4.PGE, see paging_set_global)
+static bool global_pages = false;
+
+// Number of frames allocated to store page tables (all page directories)
+static uint_t pt_frames = 0;
+
+static void paging_panic(char *msg) {
+    term_setcolors((term_colors_t){ RGB(255,100,100), RGB(50,50,50) });
+    term_printf("KERNEL PANIC: %s\n", msg);
+    halt();
+}
+
+// Invalidates the TLB entries of pagedir if it is the current page directory,
+// global ones included.
+static void flush_tlb(PDE_t *pagedir) {
+    if (pagedir != paging_get_current_pagedir())
+        return;
+    if (global_pages) {
+        // Toggling CR4.PGE flushes the whole TLB
+        uint32_t cr4 = read_cr4();
+        write_cr4(cr4 & ~CR4_PGE);
+        write_cr4(cr4);
+    } else {
+        paging_load_pagedir(pagedir);
+    }
+}
+
+// Replaces the 4MB page mapped by pde with a page table mapping the same frames with 4KB pages.
+// These frames are marked PTE_SHARED: they were not allocated for the page directory.
+// Returns the page table.
+static PTE_t *split_large_page(PDE_t *pagedir, PDE_t *pde) {
+    PTE_t *pt = frame_alloc();
+    pt_frames++;
+    for (uint_t i = 0; i < PAGES_IN_PT; i++) {
+        pt[i].frame_number = pde->pagetable_frame_number + i;
+        pt[i].present = 1;
+        pt[i].rw = pde->rw;
+        pt[i].user = pde->user;
+        pt[i].gp = pde->gp;
+        pt[i].available = PTE_SHARED;
+    }
+    pde->page_sz = 0;
+    pde->gp = 0;
+    pde->rw = 1;
+    pde->user = 1;
+    pde->pagetable_frame_number = ADDR_TO_FRAME_NB(pt);
+    // The TLB may hold the 4MB page
+    flush_tlb(pagedir);
+    return pt;
+}
+
+// Maps the page at virtual address virt to the frame at physical address phys.
+// If the page table of the page does not exist, a frame is allocated to store it
+// (a 4MB page containing virt is split into 4KB pages).
+// Returns the address of the newly allocated page table or NULL if none was allocated.
+static PTE_t *mmap_page(PDE_t *pagedir, uint32_t virt, uint32_t phys, enum privilege_t privilege, enum access_t access) {
+    PDE_t *pde = pagedir + ADDR_TO_PDE(virt);
+    PTE_t *pt;
+    bool new_pt = false;
+
+    if (pde->present && pde->page_sz) {
+        pt = split_large_page(pagedir, pde);
+        new_pt = true;
+    } else if (pde->present) {
+        pt = (PTE_t *)FRAME_NB_TO_ADDR(pde->pagetable_frame_number);
+    } else {
+        pde->present = 1;
+        pde->rw = 1;
+        pde->user = 1;
+        pt = frame_alloc();
+        pt_frames++;
+        pde->pagetable_frame_number = ADDR_TO_FRAME_NB(pt);
+        new_pt = true;
+    }
+
+    PTE_t *pte = pt + ((virt >> 12) & (PAGES_IN_PT - 1));
+    pte->frame_number = phys >> 12;
+    pte->present = 1;
+    pte->rw = access;
+    pte->user = privilege;
+
+    return new_pt ? pt : NULL;
+}
+
+void paging_mmap(PDE_t *pagedir, uint32_t virt_addr, uint32_t phys_addr, uint32_t size, enum privilege_t privilege, enum access_t access) {
+    if (virt_addr & (PAGE_SIZE - 1))
+        paging_panic("paging_mmap(): virtual addr must be aligned to 4KB!");
+    if (phys_addr & (PAGE_SIZE - 1))
+        paging_panic("paging_mmap(): physical addr must be aligned to 4KB!");
+
+    uint_t count = PAGE_COUNT(size);
+    while (count) {
+        // Whole 4MB aligned areas are mapped with a single page directory entry, unless a page
+        // table already maps some of their pages: replacing it would lose these pages (and the
+        // page table itself), so the area is mapped into it with 4KB pages instead
+        PDE_t *pde = pagedir + ADDR_TO_PDE(virt_addr);
+        bool has_pt = pde->present && !pde->page_sz;
+        if (large_pages && !has_pt && count >= PAGES_IN_PT && !((virt_addr | phys_addr) & (LARGE_PAGE_SIZE - 1))) {
+            *pde = (PDE_t){ 0 };
+            pde->present = 1;
+            pde->rw = access;
+            pde->user = privilege;
+            pde->page_sz = 1;
+            pde->pagetable_frame_number = phys_addr >> 12;
+            virt_addr += LARGE_PAGE_SIZE;
+            phys_addr += LARGE_PAGE_SIZE;
+            count -= PAGES_IN_PT;
+        } else {
+            mmap_page(pagedir, virt_addr, phys_addr, privilege, access);
+            virt_addr += PAGE_SIZE;
+            phys_addr += PAGE_SIZE;
+            count--;
+        }
+    }
+}
+
+// Returns the index of the first free slot of page_tables (0 if page_tables is NULL).
+static uint_t first_free_pt(PTE_t *page_tables[PAGETABLES_IN_PD]) {
+    uint_t first = 0;
+    if (page_tables) {
+        while (page_tables[first])
+            first++;
+    }
+    return first;
+}
+
+uint_t paging_alloc(PDE_t *pagedir, PTE_t *page_tables[PAGETABLES_IN_PD], uint32_t virt_addr, uint32_t size, enum privilege_t privilege) {
+    if (virt_addr & (PAGE_SIZE - 1))
+        paging_panic("paging_alloc_new(): virtual addr must be aligned to 4KB!");
+
+    // Newly allocated page tables are stored after the ones already recorded
+    uint_t first = first_free_pt(page_tables);
+    uint_t count = PAGE_COUNT(size);
+    uint_t pt_count = 0;
+    for (uint_t i = 0; i < count; i++) {
+        uint32_t frame = (uint32_t)frame_alloc();
+        PTE_t *pt = mmap_page(pagedir, virt_addr, frame, privilege, ACCESS_READWRITE);
+        if (page_tables && pt)
+            page_tables[first + pt_count++] = pt;
+        virt_addr += PAGE_SIZE;
+    }
+
+    return count + pt_count;
+}
+
+uint_t paging_share(PDE_t *pagedir, PTE_t *page_tables[PAGETABLES_IN_PD], uint32_t virt_addr, uint32_t phys_addr, uint32_t size, uint_t flags) {
+    if ((virt_addr | phys_addr) & (PAGE_SIZE - 1))
+        paging_panic("paging_share(): addresses must be aligned to 4KB!");
+
+    uint_t first = first_free_pt(page_tables);
+    uint_t pt_count = 0;
+    for (uint_t i = 0; i < PAGE_COUNT(size); i++) {
+        PTE_t *pt = mmap_page(pagedir, virt_addr, phys_addr, PRIVILEGE_USER, ACCESS_READONLY);
+        if (page_tables && pt)
+            page_tables[first + pt_count++] = pt;
+        paging_get_pte(pagedir, virt_addr)->available = PTE_SHARED | flags;
+        virt_addr += PAGE_SIZE;
+        phys_addr += PAGE_SIZE;
+    }
+
+    return pt_count;
+}
+
+bool paging_set_global(PDE_t *pagedir, uint32_t virt_addr, uint32_t size) {
+    if (!cpu_has_pge())
+        return false;
+
+    uint32_t end = virt_addr + size;
+    while (virt_addr < end) {
+        PDE_t *pde = pagedir + ADDR_TO_PDE(virt_addr);
+        if (pde->present && pde->page_sz) {
+            pde->gp = 1;
+            virt_addr = (virt_addr & ~(LARGE_PAGE_SIZE - 1)) + LARGE_PAGE_SIZE;
+            continue;
+        }
+        PTE_t *pte = paging_get_pte(pagedir, virt_addr);
+        if (pte && pte->present)
+            pte->gp = 1;
+        virt_addr += PAGE_SIZE;
+    }
+
+    // Enabling global pages flushes the TLB, otherwise the entries marked above are flushed
+    if (!global_pages) {
+        write_cr4(read_cr4() | CR4_PGE);
+        global_pages = true;
+    } else {
+        flush_tlb(pagedir);
+    }
+    return true;
+}
+
+PTE_t *paging_get_pte(PDE_t *pagedir, uint32_t virt_addr) {
+    PDE_t *pde = pagedir + ADDR_TO_PDE(virt_addr);
+    if (!pde->present || pde->page_sz)
+        return NULL;
+    PTE_t *pt = (PTE_t *)FRAME_NB_TO_ADDR(pde->pagetable_frame_number);
+    return pt + ((virt_addr >> 12) & (PAGES_IN_PT - 1));
+}
+
+uint_t paging_reserve(PDE_t *pagedir, uint32_t virt_addr, uint32_t size) {
+    uint_t count = 0;
+    for (uint_t i = ADDR_TO_PDE(virt_addr); i <= ADDR_TO_PDE(virt_addr + size - 1); i++) {
+        PDE_t *pde = pagedir + i;
+        if (pde->present)
+            continue;
+        PTE_t *pt = frame_alloc();
+        pt_frames++;
+        pde->present = 1;
+        pde->rw = 1;
+        pde->user = 1;
+        pde->pagetable_frame_number = ADDR_TO_FRAME_NB(pt);
+        count++;
+    }
+    return count;
+}
+
+void paging_unmap(PDE_t *pagedir, uint32_t virt_addr, uint32_t size) {
+    if (virt_addr & (PAGE_SIZE - 1))
+        paging_panic("paging_unmap(): virtual addr must be aligned to 4KB!");
+
+    for (uint_t i = 0; i < PAGE_COUNT(size); i++, virt_addr += PAGE_SIZE) {
+        PTE_t *pte = paging_get_pte(pagedir, virt_addr);
+        if (!pte || !pte->present)
+            continue;
+        *pte = (PTE_t){ 0 };
+        invlpg(virt_addr);
+    }
+}
+
+uint_t paging_share_cow(PDE_t *dst_pagedir, PTE_t *dst_page_tables[PAGETABLES_IN_PD], PDE_t *src_pagedir, uint32_t virt_addr, uint32_t size) {
+    if (virt_addr & (PAGE_SIZE - 1))
+        paging_panic("paging_share_cow(): virtual addr must be aligned to 4KB!");
+
+    bool current = src_pagedir == paging_get_current_pagedir();
+    uint_t first = first_free_pt(dst_page_tables);
+    uint_t pt_count = 0;
+    uint_t ref_count = 0;
+    for (uint_t i = 0; i < PAGE_COUNT(size); i++, virt_addr += PAGE_SIZE) {
+        PTE_t *src = paging_get_pte(src_pagedir, virt_addr);
+        if (!src || !src->present)
+            continue;
+
+        // Frames not owned by src_pagedir (PTE_SHARED) are not reference counted
+        if (!(src->available & PTE_SHARED)) {
+            frame_ref((void *)FRAME_NB_TO_ADDR(src->frame_number));
+            ref_count++;
+        }
+        // Writable pages become read-only in both page directories until written
+        if (src->rw) {
+            src->rw = 0;
+            src->available |= PTE_COW;
+            if (current)
+                invlpg(virt_addr);
+        }
+
+        PTE_t *pt = mmap_page(dst_pagedir, virt_addr, FRAME_NB_TO_ADDR(src->frame_number), src->user, ACCESS_READONLY);
+        if (pt) {
+            if (dst_page_tables)
+                dst_page_tables[first + pt_count] = pt;
+            pt_count++;
+        }
+        *paging_get_pte(dst_pagedir, virt_addr) = *src;
+    }
+
+    return pt_count + ref_count;
+}
+
+int paging_cow_fault(PDE_t *pagedir, uint32_t virt_addr) {
+    virt_addr &= ~(PAGE_SIZE - 1);
+    PTE_t *pte = paging_get_pte(pagedir, virt_addr);
+    if (!pte || !pte->present || !(pte->available & PTE_COW))
+        return -1;
+
+    // The last reference to an owned frame simply becomes writable again
+    int added = 0;
+    void *frame = (void *)FRAME_NB_TO_ADDR(pte->frame_number);
+    if ((pte->available & PTE_SHARED) || frame_refcount(frame) > 1) {
+        void *copy = frame_alloc();
+        memcpy(copy, frame, PAGE_SIZE);
+        // The copy of a reference counted frame replaces the reference of pagedir
+        if (pte->available & PTE_SHARED)
+            added = 1;
+        else
+            frame_free(frame);
+        pte->frame_number = ADDR_TO_FRAME_NB(copy);
+    }
+    pte->rw = 1;
+    pte->available = 0;
+    if (pagedir == paging_get_current_pagedir())
+        invlpg(virt_addr);
+    return added;
+}
+
+void paging_init(uint_t RAM_in_KB) {
+    frame_init(RAM_in_KB);
+    memset(kernel_pagedir, 0, sizeof(kernel_pagedir));
+
+    // 4MB pages: fewer page tables to build and far fewer TLB misses over the RAM and framebuffer
+    large_pages = cpu_has_pse();
+    if (large_pages) {
+        write_cr4(read_cr4() | CR4_PSE);
+        term_puts("4MB pages enabled.\n");
+    }
+
+    paging_mmap(kernel_pagedir, 0, 0, RAM_in_KB*1024, PRIVILEGE_KERNEL, ACCESS_READWRITE);
+    term_printf("Available RAM (%dKB) identity mapped (%d page tables).\n", RAM_in_KB, pt_frames);
+
+    vbe_fb_t *fb = vbe_get_fb();
+    uint_t pt_before = pt_frames;
+    // Only the framebuffer itself: the video memory beyond it is not known to exist.
+    // Its end is mapped with 4KB pages if it does not fill a whole 4MB page.
+    paging_mmap(kernel_pagedir, (uint32_t)fb->addr, (uint32_t)fb->addr, fb->size, PRIVILEGE_KERNEL, ACCESS_READWRITE);
+    term_printf("VBE framebuffer (%dKB) identity mapped (%d page tables).\n", fb->size/1024, pt_frames - pt_before);
+
+    paging_load_pagedir(kernel_pagedir);
+    paging_enable();
+    // Read-only pages are also read-only for the kernel: its writes into a copy-on-write
+    // page of a task (e.g. a syscall filling a buffer) fault like the task's own writes.
+    // Writes into its code terminate the task (see exception_handler).
+    write_cr0(read_cr0() | CR0_WP);
+    term_puts("Paging initialized.\n");
+}
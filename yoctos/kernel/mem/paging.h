@@ -2,10 +2,13 @@
 #define _PAGING_H_
 
 #include "common/types.h"
+#include "common/kbench.h"
 
 // The hardware supports 3 page sizes: 4KB, 4MB and 2MB (when PAE is enabled)
-// Our kernel only uses 4KB pages.
+// Our kernel uses 4KB pages, and 4MB pages for the identity mappings when the CPU supports them
+// (see paging_mmap).
 #define PAGE_SIZE  4096
+#define LARGE_PAGE_SIZE  (4*1024*1024)
 
 // The maximum number of pages in total on a IA-32 architecture is 2^20 (= 1048576 pages).
 // 1048576 * 4096KB = 4GB
@@ -87,6 +90,10 @@ typedef struct {
     // The 20 bits above are the most significant
 } __attribute__((packed)) PTE_t;
 
+// Flags stored in the "available" bits of a PTE (see paging_share and paging_share_cow)
+#define PTE_SHARED  (1 << 0)  // the frame is not owned by the page directory: never free it with it
+#define PTE_COW     (1 << 1)  // copy-on-write: read-only until the first write, which maps a private copy
+
 // Setup the kernel page directory with the following two mappings:
 // - Identity map the available RAM so that the kernel can access it as if there was no paging.
 // - Identity map the VBE framebuffer.
@@ -96,6 +103,9 @@ extern void paging_init(uint_t RAM_in_KB);
 // Maps, in the specified page directory, size bytes starting at virtual address virt_addr
 // into physical address phys_addr. Both virtual and physical areas are contiguous.
 // This function dynamically allocates the necessary frames to store the page tables.
+// When the CPU supports them, 4MB pages are used for the parts of the area where both addresses
+// are aligned to 4MB and not already covered by a page table. Mapping 4KB pages inside such a page
+// later splits it.
 // IMPORTANT: virt_addr and phys_addr must be aligned to a page size (4KB).
 extern void paging_mmap(PDE_t *pagedir, uint32_t virt_addr, uint32_t phys_addr, uint32_t size, enum privilege_t privilege, enum access_t access);
 
@@ -121,4 +131,59 @@ extern PDE_t *paging_get_current_pagedir();
 // Returns the number of frames allocated (including frames used to store page tables).
 extern uint_t paging_alloc(PDE_t *pagedir, PTE_t *page_tables[PAGETABLES_IN_PD], uint32_t virt_addr, uint32_t size, enum privilege_t privilege);
 
+// Maps size bytes of physical memory at phys_addr, read-only for the user, at virtual address
+// virt_addr. The frames are marked with PTE_SHARED and the specified additional flags (e.g. PTE_COW):
+// they remain owned by someone else (e.g. a module) and must not be freed with the page directory.
+// Page tables are allocated and recorded as with paging_alloc.
+// IMPORTANT: virt_addr and phys_addr must be aligned to a page size (4KB).
+// Returns the number of frames allocated to store page tables.
+extern uint_t paging_share(PDE_t *pagedir, PTE_t *page_tables[PAGETABLES_IN_PD], uint32_t virt_addr, uint32_t phys_addr, uint32_t size, uint_t flags);
+
+// Shares the pages mapped between virt_addr and virt_addr+size in src_pagedir with dst_pagedir,
+// at the same virtual addresses: both page directories then map the same frames, whose reference
+// counts are incremented (see frame_ref). Writable pages become read-only copy-on-write pages in
+// both page directories (see paging_cow_fault). Pages that are not present are skipped.
+// Page tables are allocated in dst_pagedir and recorded into dst_page_tables as with paging_alloc.
+// A reference counted frame counts as a frame of each page directory referencing it.
+// IMPORTANT: virt_addr must be aligned to a page size (4KB).
+// Returns the number of frames added to dst_pagedir: the frames referenced (PTE_SHARED excluded)
+// and the frames allocated to store page tables.
+extern uint_t paging_share_cow(PDE_t *dst_pagedir, PTE_t *dst_page_tables[PAGETABLES_IN_PD], PDE_t *src_pagedir, uint32_t virt_addr, uint32_t size);
+
+// Handles a write into the copy-on-write page containing virt_addr: the page is remapped read-write
+// to a private copy of its frame, or to the frame itself if this was its last reference.
+// At least one frame must be available.
+// Returns the number of frames added to pagedir: 1 for the copy of a PTE_SHARED frame, 0 otherwise
+// (the copy of a reference counted frame replaces the reference, the last reference was already
+// counted, see paging_share_cow), or -1 if the page is not a copy-on-write page.
+extern int paging_cow_fault(PDE_t *pagedir, uint32_t virt_addr);
+
+// Shares count pages (up to PAGES_IN_PT) copy-on-write between two page directories, writes into
+// them from both sides and checks the frames' contents and reference counts.
+// Implemented in paging_bench.c
+extern void paging_cow_bench(uint_t count, kbench_cow_t *res);
+
+// Marks the pages mapped between virt_addr and virt_addr+size as global (CR4.PGE): their TLB entries
+// are kept when CR3 is reloaded. Only valid for mappings that are identical in every page directory
+// (e.g. the kernel identity map, see tasks_init). Modifying such a mapping requires a TLB flush that
+// includes global entries (invlpg or toggling CR4.PGE).
+// Returns false if the CPU does not support global pages.
+extern bool paging_set_global(PDE_t *pagedir, uint32_t virt_addr, uint32_t size);
+
+// Returns the page table entry mapping virt_addr in the specified page directory,
+// or NULL if the page table covering virt_addr does not exist (or if virt_addr is part of a 4MB page).
+extern PTE_t *paging_get_pte(PDE_t *pagedir, uint32_t virt_addr);
+
+// Allocates the missing page tables covering virt_addr to virt_addr+size, without mapping any page.
+// Once the page directory entries are copied into other page directories, the pages mapped later
+// in this area with paging_mmap are mapped in all of them (e.g. the kernel stacks, see task.c).
+// Returns the number of page tables allocated.
+extern uint_t paging_reserve(PDE_t *pagedir, uint32_t virt_addr, uint32_t size);
+
+// Unmaps the pages mapped between virt_addr and virt_addr+size. Their frames are not freed.
+// The TLB entries of the pages are invalidated (those cached for other page directories are
+// flushed anyway when CR3 is reloaded, since such pages are not global).
+// IMPORTANT: virt_addr must be aligned to a page size (4KB).
+extern void paging_unmap(PDE_t *pagedir, uint32_t virt_addr, uint32_t size);
+
 #endif
@@ -0,0 +1,114 @@
+#include "common/types.h"
+#include "common/cpu.h"
+#include "common/kbench.h"
+#include "common/mem.h"
+#include "x86.h"
+#include "paging.h"
+#include "frame.h"
+
+// Self-test and benchmark of the copy-on-write sharing of pages between two page directories
+// (e.g. a forked task): the pages are shared, then written into from both sides, as done by
+// task_page_fault. Neither page directory is loaded: the frames are accessed through the
+// identity mapping of the kernel.
+
+#define BENCH_ADDR 0x40000000
+
+// Page tables of both page directories (NULL terminated, see paging_alloc)
+static PTE_t *src_pts[PAGETABLES_IN_PD];
+static PTE_t *dst_pts[PAGETABLES_IN_PD];
+
+// Returns the frame mapped at virt_addr in pagedir.
+static uint32_t *page_frame(PDE_t *pagedir, uint32_t virt_addr) {
+    return (uint32_t *)FRAME_NB_TO_ADDR(paging_get_pte(pagedir, virt_addr)->frame_number);
+}
+
+// Releases the frames mapped by a page directory, its page tables and the directory itself.
+static void free_pagedir(PDE_t *pagedir, PTE_t **page_tables) {
+    for (uint_t pt = 0; page_tables[pt]; pt++) {
+        for (uint_t i = 0; i < PAGES_IN_PT; i++) {
+            if (page_tables[pt][i].present)
+                frame_free((void *)FRAME_NB_TO_ADDR(page_tables[pt][i].frame_number));
+        }
+        frame_free(page_tables[pt]);
+    }
+    frame_free(pagedir);
+}
+
+void paging_cow_bench(uint_t count, kbench_cow_t *res) {
+    if (count == 0)
+        count = 1;
+    if (count > PAGES_IN_PT)
+        count = PAGES_IN_PT;
+    uint32_t size = count * PAGE_SIZE;
+
+    // The allocator is not thread-safe: the timer must not schedule another task meanwhile
+    uint32_t flags = irq_save();
+
+    res->errors = 0;
+    memset(src_pts, 0, sizeof(src_pts));
+    memset(dst_pts, 0, sizeof(dst_pts));
+    PDE_t *src = frame_alloc();
+    PDE_t *dst = frame_alloc();
+    uint_t src_frames = paging_alloc(src, src_pts, BENCH_ADDR, size, PRIVILEGE_USER);
+    for (uint_t i = 0; i < count; i++)
+        memsetdw(page_frame(src, BENCH_ADDR + i * PAGE_SIZE), i, PAGE_SIZE/4);
+
+    uint64_t start = rdtsc();
+    uint_t dst_frames = paging_share_cow(dst, dst_pts, src, BENCH_ADDR, size);
+    res->share = (rdtsc() - start) / count;
+
+    // Each page directory counts the shared frames (see paging_share_cow)
+    if (dst_frames != count + 1)
+        res->errors++;
+    for (uint_t i = 0; i < count; i++) {
+        uint32_t addr = BENCH_ADDR + i * PAGE_SIZE;
+        PTE_t *s = paging_get_pte(src, addr);
+        PTE_t *d = paging_get_pte(dst, addr);
+        if (s->frame_number != d->frame_number || s->rw || d->rw || frame_refcount(page_frame(src, addr)) != 2)
+            res->errors++;
+    }
+
+    // First write from dst: it gets a copy, src keeps the frame
+    start = rdtsc();
+    for (uint_t i = 0; i < count; i++)
+        dst_frames += paging_cow_fault(dst, BENCH_ADDR + i * PAGE_SIZE);
+    res->copy = (rdtsc() - start) / count;
+
+    for (uint_t i = 0; i < count; i++) {
+        uint32_t addr = BENCH_ADDR + i * PAGE_SIZE;
+        uint32_t *s = page_frame(src, addr);
+        uint32_t *d = page_frame(dst, addr);
+        if (s == d || frame_refcount(s) != 1 || frame_refcount(d) != 1 || memcmp(s, d, PAGE_SIZE))
+            res->errors++;
+        d[0] = ~i;
+    }
+
+    // Then from src: its reference is the last one, the frame is kept
+    start = rdtsc();
+    for (uint_t i = 0; i < count; i++) {
+        uint32_t addr = BENCH_ADDR + i * PAGE_SIZE;
+        uint32_t *frame = page_frame(src, addr);
+        src_frames += paging_cow_fault(src, addr);
+        if (page_frame(src, addr) != frame || !paging_get_pte(src, addr)->rw)
+            res->errors++;
+    }
+    res->reuse = (rdtsc() - start) / count;
+
+    for (uint_t i = 0; i < count; i++) {
+        uint32_t addr = BENCH_ADDR + i * PAGE_SIZE;
+        uint32_t *s = page_frame(src, addr);
+        s[1] = ~i;
+        if (s[0] != i || page_frame(dst, addr)[0] != ~i || page_frame(dst, addr)[1] != i)
+            res->errors++;
+    }
+
+    // Neither write changed the number of frames of a page directory:
+    // count pages and one page table each
+    if (src_frames != count + 1 || dst_frames != count + 1)
+        res->errors++;
+
+    free_pagedir(src, src_pts);
+    free_pagedir(dst, dst_pts);
+
+    irq_restore(flags);
+}
@@ -1,16 +1,36 @@
 #include "boot/multiboot.h"
+#include "boot/module.h"
 #include "common/types.h"
+#include "common/cpu.h"
+#include "common/syscall_nb.h"
+#include "common/kbench.h"
+#include "common/stats.h"
+#include "common/sysring.h"
 #include "mem/gdt.h"
+#include "descriptors.h"
 #include "task/task.h"
 #include "mem/frame.h"
 #include "mem/paging.h"
+#include "mem/kmalloc.h"
 #include "drivers/term.h"
 #include "drivers/vbe.h"
 #include "drivers/timer.h"
+#include "drivers/ktimer.h"
 #include "drivers/keyboard.h"
 #include "syscall.h"
+#include "fpu.h"
 #include "x86.h"
 
+// SYSENTER model specific registers
+#define MSR_SYSENTER_CS   0x174
+#define MSR_SYSENTER_ESP  0x175
+#define MSR_SYSENTER_EIP  0x176
+
+// Implemented in syscall_asm.s
+extern void _sysenter_handler();
+
+static bool sysenter_enabled = false;
+
 static int syscall_term_puts(uint32_t arg1, uint32_t arg2, uint32_t arg3, uint32_t arg4) {
 	UNUSED(arg2);
 	UNUSED(arg3);
@@ -36,6 +56,21 @@ static int syscall_keyb_get_key(uint32_t arg1, uint32_t arg2, uint32_t arg3, uin
 	return 0;
 }
 
+// Blocks the task until keys are available and stores them at address arg1 (see keyboard.h).
+// arg2 is the size of the buffer (in keys in raw mode, in bytes in line mode) and arg3 the mode.
+// Returns the number of keys stored (raw mode) or the length of the line, -1 if the mode is invalid.
+static int syscall_keyb_read(uint32_t arg1, uint32_t arg2, uint32_t arg3, uint32_t arg4) {
+	UNUSED(arg4);
+	switch (arg3) {
+		case KEYB_READ_RAW:
+			return keyb_read((int *)arg1, arg2);
+		case KEYB_READ_LINE:
+			return keyb_read_line((char *)arg1, arg2);
+		default:
+			return -1;
+	}
+}
+
 static int syscall_timer_info(uint32_t arg1, uint32_t arg2, uint32_t arg3, uint32_t arg4) {
 	UNUSED(arg3);
 	UNUSED(arg4);
@@ -52,26 +87,86 @@ static int syscall_timer_sleep(uint32_t arg1, uint32_t arg2, uint32_t arg3, uint
 	return 0;
 }
 
+// Stores the framebuffer information at address arg1.
+// If arg2 is true, addr is the address of a back buffer private to the task (see task_backbuffer):
+// the task must then call the flush syscall to display what it draws.
+// Returns -1 if a back buffer was requested but could not be allocated.
 static int syscall_vbe_fb_info(uint32_t arg1, uint32_t arg2, uint32_t arg3, uint32_t arg4) {
-	UNUSED(arg2);
 	UNUSED(arg3);
 	UNUSED(arg4);
 	vbe_fb_t* vb = (vbe_fb_t*) arg1;
 	*vb = *vbe_get_fb();
+	if (arg2) {
+		uint32_t buf = task_backbuffer(vb->size);
+		if (!buf)
+			return -1;
+		vb->addr = (uint16_t *)buf;
+	}
 	return 0;
-} 
+}
 
 static int syscall_vbe_setpix(uint32_t arg1, uint32_t arg2, uint32_t arg3, uint32_t arg4) {
 	UNUSED(arg4);
 	vbe_setpixel((int) arg1, (int) arg2, (uint16_t) arg3);
+	return 0;
 }
 
-static int syscall_task_exec(uint32_t arg1, uint32_t arg2, uint32_t arg3, uint32_t arg4) {
+static int syscall_vbe_fill_rect(uint32_t arg1, uint32_t arg2, uint32_t arg3, uint32_t arg4) {
+	UNUSED(arg3);
+	UNUSED(arg4);
+	vbe_fill_rect((vbe_rect_t *)arg1, (uint16_t)arg2);
+	return 0;
+}
+
+static int syscall_vbe_blit(uint32_t arg1, uint32_t arg2, uint32_t arg3, uint32_t arg4) {
 	UNUSED(arg4);
-	task_exec((char *) arg1, (int)arg2, (char**)arg3);
+	vbe_blit((vbe_rect_t *)arg1, (uint16_t *)arg2, (uint_t)arg3);
 	return 0;
 }
 
+static int syscall_vbe_copy_rect(uint32_t arg1, uint32_t arg2, uint32_t arg3, uint32_t arg4) {
+	UNUSED(arg4);
+	vbe_copy_rect((vbe_rect_t *)arg1, (int)arg2, (int)arg3);
+	return 0;
+}
+
+// Copies the rectangle arg1 (whole screen if NULL) of the task's back buffer to the framebuffer.
+// The drawing syscalls of tasks without a back buffer go through the kernel's, whose dirty
+// areas are flushed instead.
+static int syscall_vbe_flush(uint32_t arg1, uint32_t arg2, uint32_t arg3, uint32_t arg4) {
+	UNUSED(arg2);
+	UNUSED(arg3);
+	UNUSED(arg4);
+	task_t *t = task_current();
+	if (!t->backbuffer) {
+		vbe_flush();
+		return 0;
+	}
+	vbe_fb_t *fb = vbe_get_fb();
+	vbe_rect_t all = { 0, 0, fb->width, fb->height };
+	vbe_present((uint16_t *)t->backbuffer, arg1 ? (vbe_rect_t *)arg1 : &all);
+	return 0;
+}
+
+static int syscall_task_exec(uint32_t arg1, uint32_t arg2, uint32_t arg3, uint32_t arg4) {
+	UNUSED(arg4);
+	return task_exec((char *) arg1, (int)arg2, (char**)arg3) ? 0 : -1;
+}
+
+static int syscall_task_spawn(uint32_t arg1, uint32_t arg2, uint32_t arg3, uint32_t arg4) {
+	UNUSED(arg4);
+	return task_spawn((char *) arg1, (int)arg2, (char**)arg3);
+}
+
+// Moves the end of the task's heap by arg1 bytes (signed).
+// Returns the previous end of the heap or -1 if it could not be moved.
+static int syscall_sbrk(uint32_t arg1, uint32_t arg2, uint32_t arg3, uint32_t arg4) {
+	UNUSED(arg2);
+	UNUSED(arg3);
+	UNUSED(arg4);
+	return (int)task_sbrk((int)arg1);
+}
+
 static int syscall_putc(uint32_t arg1, uint32_t arg2, uint32_t arg3, uint32_t arg4) {
 	UNUSED(arg2);
 	UNUSED(arg3);
@@ -97,28 +192,159 @@ static int syscall_task_addr_by_id(uint32_t arg1, uint32_t arg2, uint32_t arg3,
 	return 0;
 }
 
+static int syscall_task_exit(uint32_t arg1, uint32_t arg2, uint32_t arg3, uint32_t arg4) {
+	UNUSED(arg1);
+	UNUSED(arg2);
+	UNUSED(arg3);
+	UNUSED(arg4);
+	task_exit();
+	return 0;
+}
+
+// Runs the kernel benchmark arg1 (see common/kbench.h) arg2 times
+// and stores its results at address arg3.
+static int syscall_kbench(uint32_t arg1, uint32_t arg2, uint32_t arg3, uint32_t arg4) {
+	UNUSED(arg4);
+	switch (arg1) {
+		case KBENCH_TASK_SWITCH:
+			task_switch_bench((uint_t)arg2, (kbench_switch_t *)arg3);
+			return 0;
+		case KBENCH_TASK_LOAD:
+			return task_load_bench((uint_t)arg2, (kbench_load_t *)arg3) ? 0 : -1;
+		case KBENCH_FRAMES:
+			frame_bench((uint_t)arg2, (kbench_frames_t *)arg3);
+			return 0;
+		case KBENCH_COW:
+			paging_cow_bench((uint_t)arg2, (kbench_cow_t *)arg3);
+			return 0;
+		default:
+			return -1;
+	}
+}
+
+// Stores the kernel statistics arg1 (see common/stats.h) at address arg2.
+static int syscall_stats(uint32_t arg1, uint32_t arg2, uint32_t arg3, uint32_t arg4) {
+	UNUSED(arg3);
+	UNUSED(arg4);
+	switch (arg1) {
+		case STATS_TIMER: {
+			stats_timer_t *st = (stats_timer_t *)arg2;
+			st->freq = timer_get_freq();
+			st->ticks = timer_get_ticks();
+			st->pending_timers = ktimer_pending();
+			task_sleep_stats(st);
+			return 0;
+		}
+		case STATS_TERM:
+			term_glyph_stats((stats_term_t *)arg2);
+			return 0;
+		case STATS_FPU:
+			fpu_stats((stats_fpu_t *)arg2);
+			return 0;
+		case STATS_TASKS:
+			task_mem_stats((stats_tasks_t *)arg2);
+			return 0;
+		case STATS_FRAMES:
+			frame_stats((stats_frames_t *)arg2);
+			return 0;
+		case STATS_KMALLOC:
+			kmalloc_stats((stats_kmalloc_t *)arg2);
+			return 0;
+		default:
+			return -1;
+	}
+}
+
+static int syscall_sysring_enter(uint32_t arg1, uint32_t arg2, uint32_t arg3, uint32_t arg4);
+
 // Map syscall numbers to functions
 static int (*syscall_func[])(uint32_t arg1, uint32_t arg2, uint32_t arg3, uint32_t arg4) = {
-    syscall_term_puts,
-	syscall_term_set_colors,
-	syscall_keyb_get_key,
-	syscall_timer_info,
-	syscall_timer_sleep,
-	syscall_vbe_fb_info,
-	syscall_vbe_setpix,
-	syscall_task_exec,
-	syscall_putc,
-	syscall_mod_size,
-	syscall_task_addr_by_id
+	[SYSCALL_TERM_PUTS]        = syscall_term_puts,
+	[SYSCALL_TERM_SET_COLORS]  = syscall_term_set_colors,
+	[SYSCALL_KEYB_GET_KEY]     = syscall_keyb_get_key,
+	[SYSCALL_TIMER_INFO]       = syscall_timer_info,
+	[SYSCALL_TIMER_SLEEP]      = syscall_timer_sleep,
+	[SYSCALL_VBE_FB_INFO]      = syscall_vbe_fb_info,
+	[SYSCALL_VBE_SETPIX]       = syscall_vbe_setpix,
+	[SYSCALL_TASK_EXEC]        = syscall_task_exec,
+	[SYSCALL_PUTC]             = syscall_putc,
+	[SYSCALL_MOD_SIZE]         = syscall_mod_size,
+	[SYSCALL_TASK_ADDR_BY_ID]  = syscall_task_addr_by_id,
+	[SYSCALL_TASK_EXIT]        = syscall_task_exit,
+	[SYSCALL_KBENCH]           = syscall_kbench,
+	[SYSCALL_TASK_SPAWN]       = syscall_task_spawn,
+	[SYSCALL_STATS]            = syscall_stats,
+	[SYSCALL_SYSRING_ENTER]    = syscall_sysring_enter,
+	[SYSCALL_VBE_FILL_RECT]    = syscall_vbe_fill_rect,
+	[SYSCALL_VBE_BLIT]         = syscall_vbe_blit,
+	[SYSCALL_VBE_COPY_RECT]    = syscall_vbe_copy_rect,
+	[SYSCALL_VBE_FLUSH]        = syscall_vbe_flush,
+	[SYSCALL_SBRK]             = syscall_sbrk,
+	[SYSCALL_KEYB_READ]        = syscall_keyb_read
 };
 
 // Called by the assembly function: _syscall_handler
 // Call the syscall number nb.
 // Returns the value returned by the syscall function or -1 if nb was invalid.
 int syscall_handler(int nb, uint32_t arg1, uint32_t arg2, uint32_t arg3, uint32_t arg4) {
-	if (nb >= 0 && nb < 9) {
+	if (nb >= 0 && nb < SYSCALL_COUNT && syscall_func[nb]) {
 		return syscall_func[nb](arg1, arg2, arg3, arg4);
 	} else {
 		return -1;
 	}
 }
+
+// Executes every entry queued in the current task's syscall ring (see common/sysring.h).
+// Processing stops early if the completion queue is full.
+// Returns the number of entries executed.
+static int syscall_sysring_enter(uint32_t arg1, uint32_t arg2, uint32_t arg3, uint32_t arg4) {
+	UNUSED(arg1);
+	UNUSED(arg2);
+	UNUSED(arg3);
+	UNUSED(arg4);
+	sysring_t *ring = (sysring_t *)SYSRING_ADDR;
+	int count = 0;
+
+	while (ring->sq_head != ring->sq_tail) {
+		sysring_sqe_t *sqe = &ring->sq[ring->sq_head & SYSRING_MASK];
+		bool post = !(sqe->flags & SYSRING_F_NOCQE);
+		if (post && ring->cq_tail - ring->cq_head >= SYSRING_ENTRIES)
+			break;
+
+		int result;
+		// Entering the ring recursively or exiting from it is not allowed
+		if (sqe->nb == SYSCALL_SYSRING_ENTER || sqe->nb == SYSCALL_TASK_EXIT)
+			result = -1;
+		else
+			result = syscall_handler(sqe->nb, sqe->args[0], sqe->args[1], sqe->args[2], sqe->args[3]);
+
+		if (post) {
+			sysring_cqe_t *cqe = &ring->cq[ring->cq_tail & SYSRING_MASK];
+			cqe->user_data = sqe->user_data;
+			cqe->result = result;
+			ring->cq_tail++;
+		}
+		ring->sq_head++;
+		count++;
+	}
+	return count;
+}
+
+void syscall_init() {
+	if (!cpu_has_sysenter()) {
+		term_puts("SYSENTER not supported, syscalls use int 48 only.\n");
+		return;
+	}
+	// sysenter loads cs from this MSR and ss with cs+8 (kernel data);
+	// sysexit loads cs with cs+16 (user code) and ss with cs+24 (user data).
+	wrmsr(MSR_SYSENTER_CS, GDT_KERNEL_CODE_SELECTOR);
+	wrmsr(MSR_SYSENTER_EIP, (uint32_t)_sysenter_handler);
+	wrmsr(MSR_SYSENTER_ESP, 0);
+	sysenter_enabled = true;
+	term_puts("SYSENTER fast syscalls enabled.\n");
+}
+
+void syscall_set_kernel_stack(uint32_t esp0) {
+	if (sysenter_enabled)
+		wrmsr(MSR_SYSENTER_ESP, esp0);
+}
@@ -1,6 +1,15 @@
 #ifndef _SYSCALL_H_
 #define _SYSCALL_H_
 
+#include "common/types.h"
+
 extern int syscall_handler(int nb, uint32_t arg1, uint32_t arg2, uint32_t arg3, uint32_t arg4);
 
+// Enables the SYSENTER/SYSEXIT fast system call path if the CPU supports it.
+// The int 48 entry (see idt_init) always remains available.
+extern void syscall_init();
+
+// Sets the kernel stack used by the sysenter entry (top of the running task's kernel stack).
+extern void syscall_set_kernel_stack(uint32_t esp0);
+
 #endif
@@ -47,3 +47,41 @@ _syscall_handler:
     pop     es
     pop     ds
     iret
+
+global _sysenter_handler
+
+; Fast system call entry (sysenter instruction), see ulibc's syscall_sysenter.
+; The CPU loads cs/ss from the SYSENTER_CS MSR, esp from the SYSENTER_ESP MSR
+; (kernel stack of the running task) and jumps here with interrupts disabled.
+; The user code passes:
+;   eax = syscall number
+;   ebx, edi, ebp, esi = arguments 1 to 4
+;   ecx = user stack pointer, edx = user return address (restored by sysexit)
+; The data segment registers are left untouched on entry since the user data
+; segment is flat like the kernel's.
+_sysenter_handler:
+    push    ecx   ; user esp
+    push    edx   ; user eip
+
+    push    esi
+    push    ebp
+    push    edi
+    push    ebx
+    push    eax
+    sti           ; same as the int 48 trap gate: syscalls are interruptible
+
+    call    syscall_handler
+
+    add     esp,20
+    pop     edx
+    pop     ecx
+
+    ; The kernel may have switched tasks during the syscall and come back
+    ; with its own data segments: restore the user ones
+    mov     bx,GDT_USER_DATA_SELECTOR
+    mov     ds,bx
+    mov     es,bx
+    mov     fs,bx
+    mov     gs,bx
+
+    sysexit
@@ -1,185 +1,583 @@
+#include <stddef.h>
 #include "boot/multiboot.h"
 #include "boot/module.h"
 #include "common/mem.h"
 #include "common/string.h"
+#include "common/sysring.h"
+#include "common/vdso.h"
+#include "common/app.h"
+#include "common/cpu.h"
 #include "descriptors.h"
 #include "mem/gdt.h"
 #include "mem/frame.h"
+#include "mem/kmalloc.h"
 #include "drivers/term.h"
 #include "drivers/vbe.h"
+#include "drivers/timer.h"
+#include "drivers/ktimer.h"
+#include "syscall/syscall.h"
 #include "task.h"
 #include "x86.h"
+#include "fpu.h"
 #include "tss.h"
 #include "mem/paging.h"
 
+// Size of the stack and heap reserved for each task. Their pages are only backed by
+// frames once touched (see task_page_fault).
 #define TASK_STACK_SIZE_MB 2
+#define TASK_HEAP_SIZE_MB  16
 
-static task_t tasks[MAX_TASK_COUNT];
-static tss_t initial_tss;
-static uint8_t initial_tss_kernel_stack[65536];
+// Interrupt enable flag (IF) in the EFLAGS register
+#define EFLAGS_IF (1 << 9)
+
+// Task table: tasks[id] is the task of slot id, NULL if the slot is free.
+// It grows (doubling) as more tasks exist at the same time, up to MAX_TASK_COUNT slots.
+#define TASK_SLOTS_MIN 16
+static task_t **tasks = NULL;
+static uint_t task_slots = 0;
 static uint_t task_id = 1;  // incremented whenever a new task is created
 
+// Free slot ids, the last freed one on top: allocating and freeing a slot is O(1)
+static uint16_t *free_slots = NULL;
+static uint_t free_slot_count = 0;
+
+// Tasks that have not exited yet (see task_count)
+static uint_t live_tasks = 0;
+
+// The only TSS in the system: the CPU reads the kernel stack (ss0:esp0) of the
+// running task from it when an interrupt or syscall occurs in user mode.
+// It is updated by task_switch_to() each time a different task is scheduled.
+static tss_iomap_t kernel_tss;
+
+// Task currently running, NULL when the kernel itself (kernel_main) is running.
+static task_t *current = NULL;
+
+// Context of the kernel (kernel_main) while a task is running.
+static uint32_t kernel_esp;
+static PDE_t *kernel_pagedir;
+
+// FIFO of the tasks ready to run (round-robin).
+static task_t *runq_head = NULL;
+static task_t *runq_tail = NULL;
+
+// Sleep statistics (see task_sleep)
+static uint_t idle_ticks = 0;
+static uint_t sleep_count = 0;
+static uint_t jitter_total = 0;
+static uint_t jitter_max = 0;
+
+// Tasks that exited while nobody was waiting for them (see task_spawn).
+// They are freed by task_schedule(), once running on another kernel stack.
+static task_t *zombies = NULL;
+
+// Whether task_load maps the pages of the modules instead of copying them (see task_load_bench)
+static bool zero_copy = true;
+
+// Whether the memory usage of the tasks is printed when they are loaded and freed
+static bool verbose = true;
+
+// Implemented in task_asm.s
+extern void task_enter_user();
+
 // Template page directory for all tasks.
 // Since it will never be loaded as a page directory, there is no need to align it to 4KB.
 static PDE_t pagedir_templ[PAGETABLES_IN_PD];
 
-// Creates and returns a task from the fixed pool of tasks.
-// This function dynamically allocates the address space of size "size" (in bytes) for the task.
-// Returns NULL if it failed.
-static task_t *task_create(char *name, uint_t addr_space_size, int args_size, int argc, char **argv) {
-    // Tasks GDT entries start at gdt_first_task_entry (each task uses one GDT entry)
-    extern gdt_entry_t *gdt_first_task_entry;
-    gdt_entry_t *gdt_task_tss = gdt_first_task_entry;
-
-    
-    int total_mem_size = (TASK_STACK_SIZE_MB * 1024 * 1024) + args_size + addr_space_size;
+// Page directories of freed tasks, left as copies of the template by task_free() so that
+// the next tasks do not have to copy it again
+#define PAGEDIR_CACHE_SIZE 8
+static PDE_t *pagedir_cache[PAGEDIR_CACHE_SIZE];
+static uint_t pagedir_cached = 0;
+
+// Frames needed by task_create: page directory, kernel stack, task_t (at most 2 frames)
+// and syscall ring page (and its page table)
+#define TASK_CREATE_FRAMES (1 + KSTACK_SIZE/PAGE_SIZE + 2 + 2)
+
+// Doubles the size of the task table, whose slots must all be in use.
+// Returns false if it cannot grow anymore.
+static bool task_table_grow() {
+    uint_t slots = task_slots ? task_slots * 2 : TASK_SLOTS_MIN;
+    if (slots > MAX_TASK_COUNT)
+        slots = MAX_TASK_COUNT;
+    if (slots == task_slots)
+        return false;
 
-    // TODO
+    task_t **new_tasks = kzalloc(slots * sizeof(task_t *));
+    uint16_t *new_free = kmalloc(slots * sizeof(uint16_t));
+    if (!new_tasks || !new_free) {
+        kfree(new_tasks);
+        kfree(new_free);
+        return false;
+    }
+    memcpy(new_tasks, tasks, task_slots * sizeof(task_t *));
+    // Pushed from the last one, so that the lowest ids are allocated first
+    for (uint_t i = slots; i > task_slots; i--)
+        new_free[free_slot_count++] = i - 1;
+    kfree(tasks);
+    kfree(free_slots);
+    tasks = new_tasks;
+    free_slots = new_free;
+    task_slots = slots;
+    return true;
+}
 
-    // Look for a free task and if found:
-    // - initializes the task's fields
-    // - initializes its GDT entry and TSS selector
-    // - initializes its TSS structure
+// Creates a task in a free slot and returns it.
+// Its address space is only reserved: the image (module of image_size bytes and arguments)
+// is mapped by task_load, the heap is mapped by task_sbrk and the stack is backed on first
+// touch (see task_page_fault).
+// Returns NULL if it failed (no free slot or not enough memory).
+static task_t *task_create(uint_t image_size, int args_size, int argc, char **argv) {
+    // Look for a free slot and if found:
+    // - allocates and initializes the task's fields
     // - creates its RAM and VBE identity mappings by using the common template page directory
-    // - allocates its address space using the "paging_alloc" function
-
-    // Variables declared here to prevent compilation error 
-    task_t *t = NULL;
-	for (uint_t i = 0; i < MAX_TASK_COUNT; i++) {
-        if (!(tasks[i].in_use)) {
-            t = &tasks[i];
-            memset(t, 0, sizeof(task_t));
-            task_id++; 
-			t->in_use = true;
-			t->id = i;
-            break;
-        }
-        gdt_task_tss++;
+    // - maps its kernel stack
+    // - allocates the syscall ring page using the "paging_alloc" function
+    // - prepares its kernel stack so that the first switch to it enters user mode
+    if (frame_total_free() < TASK_CREATE_FRAMES || (!free_slot_count && !task_table_grow()))
+        return NULL;
+    task_t *t = kzalloc(sizeof(task_t));
+    if (!t)
+        return NULL;
+    uint_t slot = free_slots[--free_slot_count];
+    if (pagedir_cached) {
+        t->pagedir = pagedir_cache[--pagedir_cached];
+    } else {
+        t->pagedir = frame_alloc();
+        memcpy(t->pagedir, pagedir_templ, sizeof(pagedir_templ));
     }
 
-    if (t == NULL)
-        return NULL;
+    // The page tables of the kernel stacks are shared by all page directories (see tasks_init).
+    // The frames are zeroed, which kstack_high_water relies on.
+    t->kernel_stack = (uint8_t *)KSTACK_AREA + slot * KSTACK_SLOT_SIZE + PAGE_SIZE;
+    for (uint_t i = 0; i < KSTACK_SIZE; i += PAGE_SIZE)
+        paging_mmap(kernel_pagedir, (uint32_t)t->kernel_stack + i, (uint32_t)frame_alloc(), PAGE_SIZE,
+                    PRIVILEGE_KERNEL, ACCESS_READWRITE);
+
+    fpu_state_init(&t->fpu);
+    task_id++;
+    t->id = slot;
+    tasks[slot] = t;
+    live_tasks++;
 
-    int gdt_tss_sel = gdt_entry_to_selector(gdt_task_tss);
-    *gdt_task_tss = gdt_make_tss(&t->tss, DPL_KERNEL);
-    t->tss_selector = gdt_tss_sel;
-	
 	t->virt_addr = TASK_VIRT_ADDR;
     // aggrandir l'esapce d'addr pour les args
-	t->addr_space_size = addr_space_size + args_size;
+	t->image_size = image_size + args_size;
+    // Address space: image, heap (empty until task_sbrk), then stack (growing down from the end)
+    t->addr_space_size = PAGE_COUNT(t->image_size) * PAGE_SIZE + (TASK_HEAP_SIZE_MB + TASK_STACK_SIZE_MB) * 1024 * 1024;
+    t->brk = t->virt_addr + PAGE_COUNT(t->image_size) * PAGE_SIZE;
+    t->heap_end = t->brk;
+
+    // Initial kernel stack of the task: task_ctx_switch() pops the callee-saved
+    // registers and "returns" into task_enter_user, which irets to the application
+    // entry point (ring 3) using the frame below.
+    uint32_t *sp = (uint32_t *)(t->kernel_stack + KSTACK_SIZE);
+    *--sp = GDT_USER_DATA_SELECTOR;              // ss
+    *--sp = t->virt_addr + t->addr_space_size;   // esp
+    *--sp = EFLAGS_IF;                           // eflags
+    *--sp = GDT_USER_CODE_SELECTOR;              // cs
+    *--sp = t->virt_addr;                        // eip
+    *--sp = (uint32_t)task_enter_user;           // task_ctx_switch() return address
+    *--sp = 0;  // ebp
+    *--sp = 0;  // ebx
+    *--sp = 0;  // esi
+    *--sp = 0;  // edi
+    t->kernel_esp = (uint32_t)sp;
+
+    // Syscall ring page (see common/sysring.h)
+    t->resident_frames = paging_alloc(t->pagedir, t->page_tables, SYSRING_ADDR, PAGE_SIZE, PRIVILEGE_USER);
 
-    for (uint_t i = 0; i < PAGETABLES_IN_PD; i++)
-    {
-        t->pagedir[i] = pagedir_templ[i];
+    return t;
+}
+
+bool task_page_fault(uint32_t addr, bool present, bool write) {
+    task_t *t = current;
+    if (!t || addr < t->virt_addr || addr - t->virt_addr >= t->addr_space_size)
+        return false;
+
+    uint32_t page = addr & ~(PAGE_SIZE - 1);
+    PTE_t *pte = NULL;
+    if (present) {
+        // The only legitimate fault on a present page is the first write into a copy-on-write page
+        pte = paging_get_pte(t->pagedir, page);
+        if (!write || !(pte->available & PTE_COW))
+            return false;
+    } else if (addr - t->virt_addr < t->addr_space_size - TASK_STACK_SIZE_MB * 1024 * 1024) {
+        // Only the stack is backed on first touch: the heap is mapped by task_sbrk
+        return false;
     }
-    tss_t *tss = &t->tss;
-
-    tss->cs = GDT_USER_CODE_SELECTOR;
-    tss->ds = tss->es = tss->gs = tss->ss = GDT_USER_DATA_SELECTOR;
-    tss->cr3 = (uint32_t)t->pagedir;
-    tss->eflags = (1 << 9);
-    tss->ss0 = GDT_KERNEL_DATA_SELECTOR;
-    tss->esp0 = (uint32_t)(t->kernel_stack) + sizeof(t->kernel_stack);
-    tss->eip = t->virt_addr;
-    // tss->esp = tss->ebp = t->virt_addr + addr_space_size + (TASK_STACK_SIZE_MB << 20);
-    tss->esp = tss->ebp = t->virt_addr + total_mem_size;
 
-    uint_t alloc_frame_count = 0;
-	uint_t id = t->id;
-    alloc_frame_count = paging_alloc(t->pagedir, t->page_tables, t->virt_addr, t->addr_space_size + (TASK_STACK_SIZE_MB * 1024 * 1024) + args_size, PRIVILEGE_USER);
+    // One frame for the page, and possibly one for its page table
+    if (frame_total_free() < 2) {
+        term_printf("Task %d terminated: out of memory\n", t->id);
+        task_exit();
+    }
+
+    if (pte) {
+        if (pte->available & PTE_SHARED)
+            t->shared_pages--;
+        t->resident_frames += paging_cow_fault(t->pagedir, page);
+    } else {
+        // The page was not present, hence not in the TLB: no need to invalidate it
+        t->resident_frames += paging_alloc(t->pagedir, t->page_tables, page, PAGE_SIZE, PRIVILEGE_USER);
+    }
+    t->page_faults++;
+    return true;
+}
 
-    
-    term_printf("Allocated %dKB of RAM for task %d (\"%s\")\n", alloc_frame_count * PAGE_SIZE / 1024, id, name);
+uint32_t task_sbrk(int increment) {
+    task_t *t = current;
+    uint32_t heap_start = t->virt_addr + PAGE_COUNT(t->image_size) * PAGE_SIZE;
+    uint32_t heap_max = heap_start + TASK_HEAP_SIZE_MB * 1024 * 1024;
+    uint32_t old_brk = t->brk;
+    if ((increment > 0 && (uint32_t)increment > heap_max - old_brk) ||
+        (increment < 0 && 0u - (uint32_t)increment > old_brk - heap_start))
+        return (uint32_t)-1;
+
+    uint32_t new_end = (old_brk + increment + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    if (new_end > t->heap_end) {
+        // One frame per page, plus the page tables that may be needed
+        uint_t pages = (new_end - t->heap_end) / PAGE_SIZE;
+        if (frame_total_free() < pages + pages / PAGES_IN_PT + 2)
+            return (uint32_t)-1;
+        t->resident_frames += paging_alloc(t->pagedir, t->page_tables, t->heap_end, new_end - t->heap_end, PRIVILEGE_USER);
+        t->heap_end = new_end;
+    }
+    t->brk = old_brk + increment;
+    return old_brk;
+}
 
-    return t;
+uint32_t task_backbuffer(uint32_t size) {
+    task_t *t = current;
+    if (t->backbuffer)
+        return t->backbuffer;
+    // The page right above the stack is left unmapped to catch overflows of the buffer
+    size = PAGE_COUNT(size) * PAGE_SIZE;
+    uint_t pages = size / PAGE_SIZE;
+    if (frame_total_free() < pages + pages / PAGES_IN_PT + 2)
+        return 0;
+    uint32_t addr = t->virt_addr + t->addr_space_size + PAGE_SIZE;
+    t->resident_frames += paging_alloc(t->pagedir, t->page_tables, addr, size, PRIVILEGE_USER);
+    t->backbuffer = addr;
+    t->backbuffer_size = size;
+    return addr;
+}
+
+// Returns the deepest use of the task's kernel stack in bytes. Since the stack frames are
+// zeroed when allocated, the lowest non-zero dword is the deepest one ever written.
+static uint_t kstack_high_water(task_t *t) {
+    uint32_t *p = (uint32_t *)t->kernel_stack;
+    uint32_t *end = (uint32_t *)(t->kernel_stack + KSTACK_SIZE);
+    while (p < end && !*p)
+        p++;
+    return (uint8_t *)end - (uint8_t *)p;
+}
+
+bool task_owns_addr(uint32_t addr) {
+    task_t *t = current;
+    if (!t)
+        return false;
+    uint32_t end = t->backbuffer ? t->backbuffer + t->backbuffer_size : t->virt_addr + t->addr_space_size;
+    return (addr >= t->virt_addr && addr < end) || (addr >= SYSRING_ADDR && addr - SYSRING_ADDR < PAGE_SIZE);
+}
+
+bool task_kstack_guard(uint32_t addr) {
+    return addr >= KSTACK_AREA && addr < VDSO_ADDR && (addr - KSTACK_AREA) % KSTACK_SLOT_SIZE < PAGE_SIZE;
+}
+
+void task_mem_stats(stats_tasks_t *stats) {
+    uint32_t flags = irq_save();
+    stats->count = 0;
+    stats->total = 0;
+    for (uint_t i = 0; i < task_slots; i++) {
+        task_t *t = tasks[i];
+        if (!t || t->state == TASK_ZOMBIE)
+            continue;
+        if (stats->total++ >= STATS_MAX_TASKS)
+            continue;
+        stats->tasks[stats->count].id = t->id;
+        stats->tasks[stats->count].reserved = t->addr_space_size / 1024;
+        stats->tasks[stats->count].resident = t->resident_frames * PAGE_SIZE / 1024;
+        stats->tasks[stats->count].shared = t->shared_pages * PAGE_SIZE / 1024;
+        stats->tasks[stats->count].page_faults = t->page_faults;
+        stats->tasks[stats->count].kstack_used = kstack_high_water(t);
+        stats->count++;
+    }
+    irq_restore(flags);
+}
+
+task_t *task_current() {
+    return current;
 }
 
-task_t* get_task_by_selector(uint16_t selector){
-	extern gdt_entry_t *gdt_first_task_entry;
-    gdt_entry_t *gdt_task_tss = gdt_first_task_entry;
-	
-	for (uint_t i = 0; i < MAX_TASK_COUNT; i++) {
-		int gdt_tss_sel = gdt_entry_to_selector(gdt_task_tss);
-		if(selector == gdt_tss_sel){
-			return &tasks[i];	
-			break;
-		}
-		gdt_task_tss++;
-    }	
-	return NULL;
-}
- 
 // Frees a task previously created with task_create().
 // This function frees the task's page frames.
+// IMPORTANT: must not be called while running on the task's kernel stack!
 static void task_free(task_t *t) {
     // Make sure to free:
     // - every frame allocated for a page
     // - every frame allocated for a page table
     // Note: page.present indicates if a page was mapped
 
-    // Variables declared here to prevent compilation error
     uint_t alloc_frame_count = 0;
     uint_t alloc_pt_count = 0;
 
     // Iterates until reachying a NULL pointer indicating that
     // there is no more allocated page table
     for (uint_t pt = 0; t->page_tables[pt]; pt++) {
-      	PTE_t *page_table = (PTE_t *) t->page_tables[pt];
-        if (t->page_tables[pt]->present == 1) {
-            for (uint32_t i = 0; i < PAGES_IN_PT; i++) {
-				if (page_table[i].present == 1) {
-					void *addr = FRAME_NB_TO_ADDR(page_table[i].frame_number);
-					frame_free(addr);
-				}
+      	PTE_t *page_table = t->page_tables[pt];
+        for (uint32_t i = 0; i < PAGES_IN_PT; i++) {
+            // Shared frames belong to someone else (e.g. the module of the task)
+            if (page_table[i].present == 1 && !(page_table[i].available & PTE_SHARED)) {
+                frame_free((void *)FRAME_NB_TO_ADDR(page_table[i].frame_number));
+                alloc_frame_count++;
             }
-            alloc_frame_count += PAGES_IN_PT;
-            alloc_pt_count++;
-            t->page_tables[pt]->present = 0;
-            frame_free(FRAME_NB_TO_ADDR(page_table->frame_number));
         }
+        alloc_pt_count++;
+        frame_free(page_table);
     }
 
-	task_id -= 1;
-	t->in_use = false;
+    // Restores the entries of the page tables freed above, so that the page directory
+    // can be reused as is by the next task
+    uint32_t end = t->backbuffer ? t->backbuffer + t->backbuffer_size : t->virt_addr + t->addr_space_size;
+    for (uint_t i = ADDR_TO_PDE(t->virt_addr); i <= ADDR_TO_PDE(end - 1); i++)
+        t->pagedir[i] = pagedir_templ[i];
+    t->pagedir[ADDR_TO_PDE(SYSRING_ADDR)] = pagedir_templ[ADDR_TO_PDE(SYSRING_ADDR)];
+    if (pagedir_cached < PAGEDIR_CACHE_SIZE)
+        pagedir_cache[pagedir_cached++] = t->pagedir;
+    else
+        frame_free(t->pagedir);
 
-    term_printf("Freed %dKB of RAM (%d page table(s), %d frames)\n",
-                (alloc_frame_count)*PAGE_SIZE/1024,
-                alloc_pt_count, alloc_frame_count);
+    uint_t kstack_used = kstack_high_water(t);
+    for (uint_t i = 0; i < KSTACK_SIZE; i += PAGE_SIZE)
+        frame_free((void *)FRAME_NB_TO_ADDR(paging_get_pte(kernel_pagedir, (uint32_t)t->kernel_stack + i)->frame_number));
+    paging_unmap(kernel_pagedir, (uint32_t)t->kernel_stack, KSTACK_SIZE);
+
+	task_id -= 1;
+	tasks[t->id] = NULL;
+    free_slots[free_slot_count++] = t->id;
+    // Tasks freed without having run (see task_load_bench) did not go through task_exit
+    if (t->state != TASK_ZOMBIE)
+        live_tasks--;
+    fpu_release(&t->fpu);
+
+    if (verbose) {
+        term_printf("Freed %dKB of RAM (%d page table(s), %d frames), kernel stack high-water mark %d bytes\n",
+                    (alloc_frame_count+alloc_pt_count)*PAGE_SIZE/1024,
+                    alloc_pt_count, alloc_frame_count, kstack_used);
+    }
+    kfree(t);
 }
 
 // Initializes the task subsystem
 void tasks_init() {
-    memset(tasks, 0, sizeof(tasks));
-
-    // Allocates and initializes the initial TSS: it is where the CPU state
-    // will be saved before switching from the kernel to the very first user task.
-    extern gdt_entry_t *gdt_initial_tss;
-    *gdt_initial_tss = gdt_make_tss(&initial_tss, DPL_KERNEL);
-    memset(&initial_tss, 0, sizeof(tss_t));
-    initial_tss.ss0 = GDT_KERNEL_DATA_SELECTOR;
-    initial_tss.esp0 = ((uint32_t)initial_tss_kernel_stack) + sizeof(initial_tss_kernel_stack);
-    initial_tss.cr3 = (uint32_t)paging_get_current_pagedir();
-
-    // TODO
-	// Identity maps available RAM so kernel code can access its own code / data
+    // Initializes the TSS shared by all tasks. Only ss0/esp0 are used by the CPU:
+    // esp0 is set to the running task's kernel stack by task_switch_to().
+    // Its IO permission bitmap denies every port to user mode.
+    extern gdt_entry_t *gdt_kernel_tss;
+    *gdt_kernel_tss = gdt_make_tss(&kernel_tss.tss, sizeof(kernel_tss), DPL_KERNEL);
+    memset(&kernel_tss, 0, sizeof(kernel_tss));
+#if IOMAP
+    memset(kernel_tss.iomap, 0xFF, sizeof(kernel_tss.iomap));
+    kernel_tss.iomap_end = 0xFF;
+    kernel_tss.tss.iomap_base_addr = offsetof(tss_iomap_t, iomap);
+#else
+    kernel_tss.tss.iomap_base_addr = sizeof(tss_t);
+#endif
+    kernel_tss.tss.ss0 = GDT_KERNEL_DATA_SELECTOR;
+    kernel_pagedir = paging_get_current_pagedir();
+    kernel_tss.tss.cr3 = (uint32_t)kernel_pagedir;
+
     // Creates a common template page directory (pagedir_templ) that will be shared by each task.
-    // This mapping:
-    // - identity maps the available RAM so the kernel can access it during a syscall as if there
-    //   were no paging
-    // - identity maps the VBE framebuffer so that tasks can access it without requiring syscalls
+    // Its identity mappings are the ones of the kernel page directory (see paging_init), whose
+    // page tables are shared by every task:
+    // - the available RAM is identity mapped so the kernel can access it during a syscall as if
+    //   there were no paging
+    // - the VBE framebuffer is identity mapped so that tasks can access it without requiring syscalls
+    // Since these mappings are the same in every page directory, they are global: their TLB entries
+    // survive the CR3 reloads of the task switches.
+	vbe_fb_t *fb = vbe_get_fb();
+	paging_mmap(kernel_pagedir, (uint32_t)fb->addr, (uint32_t)fb->addr, fb->size, PRIVILEGE_USER, ACCESS_READWRITE);
+    paging_load_pagedir(kernel_pagedir);
 
-	paging_mmap(pagedir_templ, 0, 0, multiboot_get_RAM_in_KB () *1024, PRIVILEGE_KERNEL, ACCESS_READWRITE);
+    uint32_t RAM_size = multiboot_get_RAM_in_KB() * 1024;
+    if (paging_set_global(kernel_pagedir, 0, RAM_size) && paging_set_global(kernel_pagedir, (uint32_t)fb->addr, fb->size))
+        term_puts("Kernel and framebuffer mappings are global.\n");
 
-	vbe_fb_t *fb = vbe_get_fb();
-	paging_mmap(pagedir_templ, fb->addr, fb->addr, fb->size, PRIVILEGE_USER, ACCESS_READWRITE);
+    // The page tables of the kernel stacks (see task_create) are allocated now, so that they are
+    // part of every page directory
+    paging_reserve(kernel_pagedir, KSTACK_AREA, MAX_TASK_COUNT * KSTACK_SLOT_SIZE);
+    memcpy(pagedir_templ, kernel_pagedir, sizeof(pagedir_templ));
 
-    // Loads the task register to point to the initial TSS selector.
+    // Maps the timer page read-only so that tasks can read the time without syscalls.
+    // IMPORTANT: timer_init() must be called before tasks_init()!
+    paging_mmap(pagedir_templ, VDSO_ADDR, (uint32_t)timer_get_vdso(), PAGE_SIZE, PRIVILEGE_USER, ACCESS_READONLY);
+
+    // Loads the task register to point to the kernel TSS selector.
     // IMPORTANT: The GDT must already be loaded before loading the task register!
-    task_ltr(gdt_entry_to_selector(gdt_initial_tss));
+    task_ltr(gdt_entry_to_selector(gdt_kernel_tss));
 
     term_puts("Tasks initialized.\n");
 }
 
+// Switches from the running context to task "next" (NULL switches back to the kernel).
+// Returns when the calling context is switched to again.
+static void task_switch_to(task_t *next) {
+    uint32_t flags = irq_save();
+
+    uint32_t *save_esp = current ? &current->kernel_esp : &kernel_esp;
+    uint32_t next_esp = next ? next->kernel_esp : kernel_esp;
+    PDE_t *pagedir = next ? next->pagedir : kernel_pagedir;
+
+    if (next) {
+        kernel_tss.tss.esp0 = (uint32_t)next->kernel_stack + KSTACK_SIZE;
+        syscall_set_kernel_stack(kernel_tss.tss.esp0);
+    }
+
+    // Reloading CR3 flushes the TLB: only do it when the address space changes.
+    if (paging_get_current_pagedir() != pagedir)
+        paging_load_pagedir(pagedir);
+    kernel_tss.tss.cr3 = (uint32_t)pagedir;
+
+    // The FPU/SSE registers are only switched if the next task uses them (see fpu.h)
+    fpu_switch(next ? &next->fpu : NULL);
+
+    if (next)
+        next->state = TASK_RUNNING;
+    current = next;
+    task_ctx_switch(save_esp, next_esp);
+
+    irq_restore(flags);
+}
+
+// IMPORTANT: the run queue functions must be called with interrupts disabled.
+static void runq_push(task_t *t) {
+    t->state = TASK_READY;
+    t->next = NULL;
+    if (runq_tail)
+        runq_tail->next = t;
+    else
+        runq_head = t;
+    runq_tail = t;
+}
+
+static task_t *runq_pop() {
+    task_t *t = runq_head;
+    if (t) {
+        runq_head = t->next;
+        if (!runq_head)
+            runq_tail = NULL;
+        t->next = NULL;
+    }
+    return t;
+}
+
+// Switches to the next ready task, or back to the kernel idle loop if there is none.
+// The caller must have set the state of the current task (and queued it if still ready).
+static void task_run_next() {
+    task_t *next = runq_pop();
+    if (next) {
+        next->slice = TASK_TIME_SLICE;
+        if (next == current) {
+            next->state = TASK_RUNNING;
+            return;
+        }
+    }
+    task_switch_to(next);
+}
+
+static void task_reap() {
+    while (zombies) {
+        task_t *t = zombies;
+        zombies = t->next;
+        task_free(t);
+    }
+}
+
+void task_schedule() {
+    uint32_t flags = irq_save();
+    task_reap();
+    if (current) {
+        runq_push(current);
+        task_run_next();
+    } else if (runq_head) {
+        task_run_next();
+    }
+    irq_restore(flags);
+}
+
+void task_tick(bool user_mode) {
+    if (!current) {
+        idle_ticks++;
+        return;
+    }
+    if (current->slice > 0)
+        current->slice--;
+    if (current->slice == 0 && user_mode && runq_head)
+        task_schedule();
+}
+
+// Called by the timer IRQ when a sleeping task must wake up.
+static void task_wakeup(void *data) {
+    task_t *t = data;
+    if (t->state == TASK_BLOCKED)
+        runq_push(t);
+}
+
+void task_sleep(uint_t ticks) {
+    ktimer_t timer = {
+        .expires = timer_get_ticks() + ticks,
+        .func = task_wakeup,
+        .data = current
+    };
+    uint32_t flags = irq_save();
+    ktimer_add(&timer);
+    current->state = TASK_BLOCKED;
+    task_run_next();
+
+    uint_t jitter = timer_get_ticks() - timer.expires;
+    sleep_count++;
+    jitter_total += jitter;
+    if (jitter > jitter_max)
+        jitter_max = jitter;
+    irq_restore(flags);
+}
+
+void task_wait(task_waitq_t *q) {
+    uint32_t flags = irq_save();
+    current->state = TASK_BLOCKED;
+    current->next = NULL;
+    if (q->tail)
+        q->tail->next = current;
+    else
+        q->head = current;
+    q->tail = current;
+    task_run_next();
+    irq_restore(flags);
+}
+
+void task_wake_all(task_waitq_t *q) {
+    uint32_t flags = irq_save();
+    task_t *t = q->head;
+    q->head = q->tail = NULL;
+    while (t) {
+        task_t *next = t->next;
+        runq_push(t);
+        t = next;
+    }
+    irq_restore(flags);
+}
+
+void task_sleep_stats(stats_timer_t *stats) {
+    stats->idle_ticks = idle_ticks;
+    stats->sleeps = sleep_count;
+    stats->jitter_total = jitter_total;
+    stats->jitter_max = jitter_max;
+}
+
+uint_t task_count() {
+    return live_tasks;
+}
+
 // Creates a new task with the content of the specified binary application.
 // Once loaded, the task is ready to be executed.
 // Returns NULL if it failed (ie. reached max number of tasks).
@@ -213,14 +611,36 @@ static task_t *task_load(char *filename, int argc, char **argv) {
         return NULL;
     }
 
-    t = task_create(filename, mod_size, args_size, argc, argv);
+    t = task_create(mod_size, args_size, argc, argv);
     if (!t) {
         return NULL;
     }
 
+    // Maps the module's pages when it has an application header (see common/app.h):
+    // read-only up to ro_end, then copy-on-write. Its last partial page (followed by
+    // the arguments) is always copied.
+    uint_t shared = 0;
+    uint_t ro = 0;
+    app_header_t *hdr = module_addr;
+    if (zero_copy && !((uint32_t)module_addr & (PAGE_SIZE - 1)) && mod_size >= sizeof(app_header_t) &&
+        hdr->magic == APP_MAGIC && hdr->ro_end >= t->virt_addr && !(hdr->ro_end & (PAGE_SIZE - 1))) {
+        shared = mod_size / PAGE_SIZE;
+        ro = ADDR_TO_PAGE_NB(hdr->ro_end - t->virt_addr);
+        if (ro > shared)
+            ro = shared;
+    }
+    t->resident_frames += paging_share(t->pagedir, t->page_tables, t->virt_addr, (uint32_t)module_addr,
+                                       PAGE_NB_TO_ADDR(ro), 0);
+    t->resident_frames += paging_share(t->pagedir, t->page_tables, t->virt_addr + PAGE_NB_TO_ADDR(ro),
+                                       (uint32_t)module_addr + PAGE_NB_TO_ADDR(ro), PAGE_NB_TO_ADDR(shared - ro), PTE_COW);
+    t->resident_frames += paging_alloc(t->pagedir, t->page_tables, t->virt_addr + PAGE_NB_TO_ADDR(shared),
+                                       t->image_size - PAGE_NB_TO_ADDR(shared), PRIVILEGE_USER);
+    t->shared_pages = shared;
+
     PDE_t* pagedir = paging_get_current_pagedir();
 	paging_load_pagedir(t->pagedir);
-	memcpy((void*)t->virt_addr, module_addr, mod_size);
+	fpu_memcpy((void*)t->virt_addr + PAGE_NB_TO_ADDR(shared), module_addr + PAGE_NB_TO_ADDR(shared),
+               mod_size - PAGE_NB_TO_ADDR(shared));
 
     // copie argc apres le module
     memcpy((void*)t->virt_addr + mod_size, &argc, sizeof(argc));
@@ -232,33 +652,110 @@ static task_t *task_load(char *filename, int argc, char **argv) {
     }
 
 	paging_load_pagedir(pagedir);
+
+    if (verbose) {
+        term_printf("Reserved %dKB for task %d (\"%s\"), %dKB resident, %dKB shared\n",
+                    t->addr_space_size / 1024, t->id, filename,
+                    t->resident_frames * PAGE_SIZE / 1024, t->shared_pages * PAGE_SIZE / 1024);
+    }
     return t;
 }
 
+bool task_load_bench(uint_t count, kbench_load_t *res) {
+    char name[sizeof(res->name)];
+    strncpy(name, res->name, sizeof(name));
+    name[sizeof(name) - 1] = 0;
+
+    bool loaded = true;
+    res->shared_pages = 0;
+    verbose = false;
+    for (int copy = 0; copy < 2 && loaded; copy++) {
+        zero_copy = !copy;
+        uint_t done = 0;
+        uint64_t start = rdtsc();
+        for (; done < count; done++) {
+            task_t *t = task_load(name, 0, NULL);
+            if (!t)
+                break;
+            res->shared_pages = t->shared_pages;
+            task_free(t);
+        }
+        // Only the loads that succeeded are measured (e.g. the RAM may run out)
+        uint32_t cycles = done ? (rdtsc() - start) / done : 0;
+        if (copy)
+            res->copy = cycles;
+        else
+            res->map = cycles;
+        loaded = done > 0;
+    }
+    zero_copy = true;
+    verbose = true;
+    return loaded;
+}
+
 
 // Loads a task and executes it.
-// Returns false if it failed.
+// Returns once the task has exited or false if it failed.
 bool task_exec(char *filename, int argc, char **argv) {
+    if (!current)
+        return task_spawn(filename, argc, argv) >= 0;
+
     task_t *t = task_load(filename,  argc, argv);
     if (!t) {
         return false;
     }
     term_colors_t cols = term_getcolors();
-    task_switch(t->tss_selector);
+
+    uint32_t flags = irq_save();
+    t->waiter = current;
+    runq_push(t);
+    current->state = TASK_BLOCKED;
+    task_run_next();
+    irq_restore(flags);
+
+    // The task has exited (see task_exit): we are running on our own kernel stack,
+    // hence the task's kernel stack can safely be released.
     term_setcolors(cols);
     task_free(t);
     return true;
 }
 
+int task_spawn(char *filename, int argc, char **argv) {
+    task_t *t = task_load(filename,  argc, argv);
+    if (!t) {
+        return -1;
+    }
+    uint32_t flags = irq_save();
+    runq_push(t);
+    irq_restore(flags);
+    return t->id;
+}
+
+void task_exit() {
+    if (!current)
+        return;
+
+    irq_save();
+    current->state = TASK_ZOMBIE;
+    live_tasks--;
+    if (current->waiter) {
+        runq_push(current->waiter);
+    } else {
+        current->next = zombies;
+        zombies = current;
+    }
+    task_run_next();
+}
+
 void* get_task_args(task_t *task, uint_t mod_size) {
     return (void *)(task->virt_addr + mod_size);
 }
 
+task_t *task_by_id(uint_t id) {
+    return id < task_slots ? tasks[id] : NULL;
+}
+
 void* get_task_addr_by_id(uint_t id) {
-    for (int i = 0; i < MAX_TASK_COUNT; i++) {
-        if (tasks[i].in_use && tasks[i].id == id) {
-            return &tasks[i].virt_addr;
-        }
-    }
-    return NULL; // Si aucune tâche avec l'ID donné n'est trouvée
+    task_t *t = task_by_id(id);
+    return t ? &t->virt_addr : NULL; // Si aucune tâche avec l'ID donné n'est trouvée
 }
\ No newline at end of file
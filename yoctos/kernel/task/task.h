@@ -2,42 +2,176 @@
 #define _TASK_H_
 
 #include "common/types.h"
+#include "common/kbench.h"
+#include "common/stats.h"
+#include "common/vdso.h"
 #include "tss.h"
 #include "mem/paging.h"
+#include "fpu.h"
 #include "drivers/term.h"
 
-#define MAX_TASK_COUNT  8
+// Task slots only cost a pointer until used: the memory of a task is allocated when it is created
+// and the task table grows with the number of tasks (see task_create)
+#define MAX_TASK_COUNT  256
 #define MAX_ARGS 5
 #define MAX_ARGS_LENGTH 50
 
 // Virtual address (1GB) where task user code/data is mapped (i.e. application entry point)
 #define TASK_VIRT_ADDR 0x40000000
 
-// A task has these associated structures:
-// - A TSS structure (tss_t) that saves its state (context)
-// - A TSS descriptor present in the GDT (which points to the tss_t structure)
-// - A page directory
+// Kernel stacks: each task slot has KSTACK_SIZE bytes of stack, mapped when the task is created,
+// below which an unmapped guard page catches overflows (see task_kstack_guard).
+// The area is mapped in every page directory, right below the vDSO (see common/vdso.h).
+#define KSTACK_SIZE       (16*1024)
+#define KSTACK_SLOT_SIZE  (KSTACK_SIZE + PAGE_SIZE)
+#define KSTACK_AREA       (VDSO_ADDR - MAX_TASK_COUNT * KSTACK_SLOT_SIZE)
+
+// Number of timer ticks a task runs before being preempted
+#define TASK_TIME_SLICE 10
+
+typedef enum {
+    TASK_READY,     // in the run queue, waiting for the CPU
+    TASK_RUNNING,   // currently running
+    TASK_BLOCKED,   // waiting for an event (e.g. end of a sleep, termination of a child task)
+    TASK_ZOMBIE     // exited, its resources have not been freed yet
+} task_state_t;
+
+// Tasks blocked until an event occurs (see task_wait). Must be zero initialized.
 typedef struct {
-    PDE_t pagedir[PAGETABLES_IN_PD] __attribute__((aligned(4096)));  // Task page directory
-    tss_t tss __attribute__((aligned(4096)));   // Context of the task (must not cross a page boundary!)
+    struct task_st *head;
+    struct task_st *tail;
+} task_waitq_t;
+
+// A task has these associated structures, allocated when it is created (see task_create):
+// - The task_t itself (kmalloc)
+// - A kernel stack on which its context is saved while it is switched out (see KSTACK_AREA)
+// - A page directory (one frame)
+// All tasks share the same TSS (see tasks_init), only its esp0 field is updated when
+// switching from one task to another.
+typedef struct task_st {
+    PDE_t *pagedir;                     // Task page directory
     PTE_t *page_tables[PAGES_IN_PT];    // Save pointers to page tables in order to deallocate
                                         // previously allocated frames at task termination
-    bool in_use;                        // whether the task slot is in use or free
     uint_t id;                          // task id
-    uint16_t tss_selector;              // selector required when switching to the task
-    uint8_t kernel_stack[65536];        // kernel stack (4KB does not seem enough!)
+    uint32_t kernel_esp;                // kernel stack pointer saved when the task is switched out
+    task_state_t state;
+    uint_t slice;                       // remaining ticks before preemption
+    struct task_st *next;               // next task in the run queue (or wait queue, zombie list)
+    struct task_st *waiter;             // task blocked in task_exec until this task exits (NULL if none)
+    uint8_t *kernel_stack;              // lowest address of the kernel stack (KSTACK_SIZE bytes)
+    fpu_state_t fpu;                    // FPU/SSE registers, saved when another task uses them
     uint32_t virt_addr;                 // Start of the task's virtual address space
-    uint32_t addr_space_size;           // Size of the task's address space in bytes
+    uint32_t image_size;                // Size of the code/data and arguments (backed at creation)
+    uint32_t addr_space_size;           // Size of the reserved address space (image, heap and stack) in bytes
+    uint32_t brk;                       // End of the heap (see task_sbrk)
+    uint32_t heap_end;                  // End of the heap pages mapped so far (page aligned)
+    uint32_t backbuffer;                // Private back buffer (see task_backbuffer), 0 if none
+    uint32_t backbuffer_size;           // Size of the back buffer in bytes (page aligned)
+    uint_t resident_frames;             // Frames currently allocated to the task (page tables included,
+                                        // frames shared copy-on-write count for each task referencing them)
+    uint_t shared_pages;                // Pages mapped to the frames of the task's module (see task_load)
+    uint_t page_faults;                 // Pages backed on first touch or copied on write (see task_page_fault)
 } task_t;
 
 extern void tasks_init();
+
+// Loads a task and runs it, blocking the calling task until it exits.
+// Returns false if the task could not be loaded.
 extern bool task_exec(char *filename, int argc, char **argv);
 
+// Loads a task and adds it to the run queue without waiting for it.
+// Returns the id of the task or -1 if it could not be loaded.
+extern int task_spawn(char *filename, int argc, char **argv);
+
+// Terminates the current task and schedules the next one.
+// This function never returns.
+extern void task_exit();
+
+// Gives the CPU to the next ready task, if any.
+// When called by the kernel (idle loop), it returns once no task is ready anymore.
+// It also frees the resources of the tasks that exited in the background.
+extern void task_schedule();
+
+// Called on every timer tick: preempts the current task at the end of its time slice.
+// user_mode indicates whether the tick interrupted user code (the kernel is not preemptible).
+extern void task_tick(bool user_mode);
+
+// Blocks the current task during the specified number of ticks.
+extern void task_sleep(uint_t ticks);
+
+// Blocks the current task on the wait queue q until task_wake_all(q) is called.
+// IMPORTANT: interrupts must be disabled from the moment the caller checks the condition it
+// waits for, so that the event cannot occur before the task is queued. The condition must be
+// checked again on return: another task may have consumed the event in the meantime.
+extern void task_wait(task_waitq_t *q);
+
+// Makes all the tasks blocked on q ready to run, in the order they started waiting.
+// Can be called from an IRQ handler.
+extern void task_wake_all(task_waitq_t *q);
+
+// Fills the sleep related fields of the timer statistics.
+extern void task_sleep_stats(stats_timer_t *stats);
+
+// Handles a page fault at address addr in the current task's address space.
+// present and write come from the error code of the fault.
+// The stack is only reserved when the task is created: a frame is allocated and mapped
+// the first time one of its pages is touched (by the task or by the kernel on its behalf,
+// e.g. a syscall writing into a user buffer). Likewise, the data pages shared with the
+// task's module are copied on the first write.
+// Returns false if the fault is neither of these (e.g. access outside the address space or
+// beyond the end of the heap, write into the code): the caller must handle it as an error.
+// If no frame is available anymore, the task is terminated.
+extern bool task_page_fault(uint32_t addr, bool present, bool write);
+
+// Moves the end of the current task's heap (initially right after its image) by increment bytes.
+// The pages the heap grows into are mapped at once. They are not unmapped when it shrinks,
+// but reused when it grows again.
+// Returns the previous end of the heap, or (uint32_t)-1 if the heap would exceed its reserved
+// size (or go below its start), or if there are not enough free frames.
+extern uint32_t task_sbrk(int increment);
+
+// Maps a private back buffer of size bytes for the current task, above its stack, and returns
+// its address. The buffer is initially black and freed with the task; later calls return it as is.
+// Returns 0 if there are not enough free frames.
+extern uint32_t task_backbuffer(uint32_t size);
+
+// Fills the per-task memory statistics.
+extern void task_mem_stats(stats_tasks_t *stats);
+
+// Returns true if addr lies in the address space of the current task (image, heap, stack,
+// back buffer or syscall ring), whether mapped or not. Always false when no task is running.
+extern bool task_owns_addr(uint32_t addr);
+
+// Returns true if addr lies in the guard page below one of the kernel stacks.
+extern bool task_kstack_guard(uint32_t addr);
+
+// Returns the number of tasks that have not exited yet.
+extern uint_t task_count();
+
+// Returns the task currently running or NULL if the kernel itself is running.
+extern task_t *task_current();
+
+// Returns the task whose id is specified or NULL if there is none.
+// The id of a task is its slot in the task table: the lookup is a direct index.
+extern task_t *task_by_id(uint_t id);
+
 // Implemented in task_asm.s
 extern void task_ltr(uint16_t tss_selector);
 extern void task_switch(uint16_t tss_selector);
-extern uint16_t task_get_current_sel();
 
-extern task_t* get_task_by_selector(uint16_t tss_selector);
-extern task_t** get_task_addresses();
+// Saves the callee-saved registers on the current stack, stores the stack pointer
+// into *save_esp, then switches to the stack new_esp and restores the registers saved there.
+// Implemented in task_asm.s
+extern void task_ctx_switch(uint32_t *save_esp, uint32_t new_esp);
+
+// Measures the latency of the hardware and software task switches.
+// Implemented in task_bench.c
+extern void task_switch_bench(uint_t count, kbench_switch_t *res);
+
+// Measures the cost of loading and freeing the application res->name count times,
+// with the module pages mapped and copied.
+// Returns false if the application could not be loaded.
+extern bool task_load_bench(uint_t count, kbench_load_t *res);
+
+extern void *get_task_addr_by_id(uint_t id);
 #endif
@@ -1,6 +1,10 @@
+%include "const.inc"
+
 global task_ltr
 global task_switch
-global task_get_current_sel
+global task_ctx_switch
+global task_enter_user
+global task_hw_bench_loop
 
 section .data
 tss_sel_offs dd 0  ; must always be 0
@@ -22,6 +26,7 @@ task_ltr:
 ; Call the task specified by the tss selector in argument.
 ; When the CPU switches to the new task, it automatically loads the task register
 ; with the new task (ltr instruction) and the LDT from the tss.ldt_selector field.
+; NOTE: only used to benchmark hardware task switching (see task_bench.c).
 ;
 ; void task_switch(uint16_t tss_selector)
 task_switch:
@@ -32,9 +37,40 @@ task_switch:
     call    far [ecx-4]
     ret
 
-; Return the current task's TSS selector
+; Software context switch: save the callee-saved registers (cdecl) on the current
+; stack, store the stack pointer into *save_esp and restore the context saved on
+; the stack new_esp. The "ret" below returns into the code of the new context.
 ;
-; uint16_t task_get_current_sel()
-task_get_current_sel:
-    str     ax  ; store the segment selector from the task register (TR) in ax
-    ret
\ No newline at end of file
+; void task_ctx_switch(uint32_t *save_esp, uint32_t new_esp)
+task_ctx_switch:
+    mov     eax,[esp+4]  ; save_esp
+    mov     edx,[esp+8]  ; new_esp
+    push    ebp
+    push    ebx
+    push    esi
+    push    edi
+    mov     [eax],esp
+    mov     esp,edx
+    pop     edi
+    pop     esi
+    pop     ebx
+    pop     ebp
+    ret
+
+; First code executed by a newly created task (see task_create): loads the user
+; data segments and returns to the application entry point with the iret frame
+; prepared on the task's kernel stack.
+task_enter_user:
+    mov     ax,GDT_USER_DATA_SELECTOR
+    mov     ds,ax
+    mov     es,ax
+    mov     fs,ax
+    mov     gs,ax
+    iret
+
+; Body of the task called by task_bench.c to measure hardware task switches:
+; each "iret" switches back to the calling task (NT flag set by the far call),
+; the next far call resumes execution right after it.
+task_hw_bench_loop:
+    iret
+    jmp     task_hw_bench_loop
@@ -0,0 +1,88 @@
+#include "common/types.h"
+#include "common/mem.h"
+#include "common/cpu.h"
+#include "common/kbench.h"
+#include "descriptors.h"
+#include "mem/gdt.h"
+#include "mem/paging.h"
+#include "task.h"
+#include "x86.h"
+#include "tss.h"
+
+// Micro-benchmark comparing the cost of hardware task switching (far call to a TSS
+// selector, as YoctOS used to do) to the software context switch (task_ctx_switch).
+
+#define BENCH_STACK_SIZE 1024  // in 32-bit words
+
+// Implemented in task_asm.s
+extern void task_hw_bench_loop();
+
+// Hardware task used as the target of the far calls.
+static tss_t bench_tss;
+static uint32_t bench_hw_stack[BENCH_STACK_SIZE];
+
+// Software context used as the target of task_ctx_switch.
+static uint32_t bench_sw_stack[BENCH_STACK_SIZE];
+static uint32_t bench_sw_esp;
+static uint32_t bench_main_esp;
+static bool bench_reload_cr3;
+
+static void sw_bench_loop() {
+    for (;;) {
+        if (bench_reload_cr3)
+            paging_load_pagedir(paging_get_current_pagedir());
+        task_ctx_switch(&bench_sw_esp, bench_main_esp);
+    }
+}
+
+// Returns the average number of cycles per switch (a round trip is two switches).
+static uint32_t hw_bench(uint_t count) {
+    extern gdt_entry_t *gdt_bench_tss;
+
+    memset(&bench_tss, 0, sizeof(tss_t));
+    bench_tss.cs = GDT_KERNEL_CODE_SELECTOR;
+    bench_tss.ds = bench_tss.es = bench_tss.fs = bench_tss.gs = bench_tss.ss = GDT_KERNEL_DATA_SELECTOR;
+    bench_tss.cr3 = (uint32_t)paging_get_current_pagedir();
+    bench_tss.eflags = 0x2;  // interrupts disabled
+    bench_tss.eip = (uint32_t)task_hw_bench_loop;
+    bench_tss.esp = (uint32_t)bench_hw_stack + sizeof(bench_hw_stack);
+    bench_tss.iomap_base_addr = sizeof(tss_t);
+    *gdt_bench_tss = gdt_make_tss(&bench_tss, sizeof(tss_t), DPL_KERNEL);
+    uint16_t sel = gdt_entry_to_selector(gdt_bench_tss);
+
+    uint64_t start = rdtsc();
+    for (uint_t i = 0; i < count; i++)
+        task_switch(sel);
+    return (rdtsc() - start) / (2 * count);
+}
+
+static uint32_t sw_bench(uint_t count, bool reload_cr3) {
+    // Initial context as expected by task_ctx_switch: 4 registers then the return address.
+    uint32_t *sp = bench_sw_stack + BENCH_STACK_SIZE;
+    *--sp = 0;                        // sw_bench_loop's return address (never used)
+    *--sp = (uint32_t)sw_bench_loop;  // task_ctx_switch() return address
+    *--sp = 0;  // ebp
+    *--sp = 0;  // ebx
+    *--sp = 0;  // esi
+    *--sp = 0;  // edi
+    bench_sw_esp = (uint32_t)sp;
+    bench_reload_cr3 = reload_cr3;
+
+    uint64_t start = rdtsc();
+    for (uint_t i = 0; i < count; i++) {
+        if (reload_cr3)
+            paging_load_pagedir(paging_get_current_pagedir());
+        task_ctx_switch(&bench_main_esp, bench_sw_esp);
+    }
+    return (rdtsc() - start) / (2 * count);
+}
+
+void task_switch_bench(uint_t count, kbench_switch_t *res) {
+    if (count == 0)
+        count = 1;
+    uint32_t flags = irq_save();
+    res->hw_switch = hw_bench(count);
+    res->sw_switch = sw_bench(count, false);
+    res->sw_switch_cr3 = sw_bench(count, true);
+    irq_restore(flags);
+}
@@ -5,7 +5,8 @@
 
 // IMPORTANT: by default (if IOMAP is 0) all ports are accessibles from ring 3!
 // Set to 1 if iomap is needed (forbid or allow access to IO ports from user mode).
-// It requires an extra 8KB in the TSS to store the ports bitmap.
+// It requires an extra 8KB after the TSS shared by all tasks to store the ports bitmap
+// (see tss_iomap_t).
 #define IOMAP 1
 
 // Task-State Segment (TSS) structure.
@@ -28,9 +29,17 @@ typedef struct {
     uint16_t ldt_selector, reserved10;
     uint16_t reserved11;
     uint16_t iomap_base_addr;  // adress (relative to byte 0 of the TSS) of the IO permission bitmap
+} __attribute__ ((packed)) tss_t;
+
+// TSS followed by its IO permission bitmap. Only the TSS shared by all tasks needs one: the
+// other TSSs (hardware task switch benchmark, double fault handler) only run kernel code.
+// Their iomap_base_addr points beyond their limit, which denies every port to user mode.
+typedef struct {
+    tss_t tss;
 #if IOMAP
     uint8_t iomap[8192];       // IO permission bitmap for ports 0 to 0xFFFF
+    uint8_t iomap_end;         // the CPU reads 2 bytes at a time: this one must be 0xFF
 #endif
-} __attribute__ ((packed)) tss_t;
+} __attribute__ ((packed)) tss_iomap_t;
 
 #endif
@@ -1,6 +1,8 @@
 #ifndef _X86_H_
 #define _X86_H_
 
+#include "common/types.h"
+
 // Disable hardware interrupts.
 static inline void cli() {
     asm volatile("cli");
@@ -11,6 +13,87 @@ static inline void sti() {
     asm volatile("sti");
 }
 
+// Disable hardware interrupts and return the previous EFLAGS value,
+// so that the caller can restore the interrupt state with irq_restore().
+static inline uint32_t irq_save() {
+    uint32_t flags;
+    asm volatile("pushf\npop %0\ncli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+// Restore the EFLAGS value (hence the interrupt state) returned by irq_save().
+static inline void irq_restore(uint32_t flags) {
+    asm volatile("push %0\npopf" : : "r"(flags) : "memory", "cc");
+}
+
+// Enable hardware interrupts and halt the processor until the next one.
+// Since sti takes effect after the next instruction, no interrupt can occur between
+// sti and hlt: an interrupt already pending simply wakes up the CPU right away.
+// Interrupts are disabled again on return.
+static inline void idle_wait() {
+    asm volatile("sti\nhlt\ncli" : : : "memory");
+}
+
+// Read the model specific register msr.
+static inline uint64_t rdmsr(uint32_t msr) {
+    uint64_t value;
+    asm volatile("rdmsr" : "=A"(value) : "c"(msr));
+    return value;
+}
+
+// Write value into the model specific register msr.
+static inline void wrmsr(uint32_t msr, uint64_t value) {
+    asm volatile("wrmsr" : : "c"(msr), "A"(value));
+}
+
+// Control register bits
+#define CR0_MP          (1 << 1)   // monitor coprocessor: wait/fwait raise #NM when TS is set
+#define CR0_EM          (1 << 2)   // x87 emulation: x87/SSE instructions raise #NM
+#define CR0_TS          (1 << 3)   // task switched: x87/SSE instructions raise #NM
+#define CR0_NE          (1 << 5)   // native x87 error reporting (#MF)
+#define CR0_WP          (1 << 16)  // write protect: the kernel cannot write into read-only pages
+#define CR4_PSE         (1 << 4)   // page size extensions: 4MB pages
+#define CR4_PGE         (1 << 7)   // global pages: not flushed from the TLB when CR3 is reloaded
+#define CR4_OSFXSR      (1 << 9)   // OS supports FXSAVE/FXRSTOR and SSE instructions
+#define CR4_OSXMMEXCPT  (1 << 10)  // OS handles SIMD floating-point exceptions (#XM)
+
+static inline uint32_t read_cr0() {
+    uint32_t cr0;
+    asm volatile("mov %%cr0,%0" : "=r"(cr0));
+    return cr0;
+}
+
+static inline void write_cr0(uint32_t cr0) {
+    asm volatile("mov %0,%%cr0" : : "r"(cr0) : "memory");
+}
+
+// Clear CR0.TS.
+static inline void clts() {
+    asm volatile("clts" : : : "memory");
+}
+
+// Return the linear address that caused the last page fault.
+static inline uint32_t read_cr2() {
+    uint32_t cr2;
+    asm volatile("mov %%cr2,%0" : "=r"(cr2));
+    return cr2;
+}
+
+// Invalidate the TLB entry of the page containing addr.
+static inline void invlpg(uint32_t addr) {
+    asm volatile("invlpg (%0)" : : "r"(addr) : "memory");
+}
+
+static inline uint32_t read_cr4() {
+    uint32_t cr4;
+    asm volatile("mov %%cr4,%0" : "=r"(cr4));
+    return cr4;
+}
+
+static inline void write_cr4(uint32_t cr4) {
+    asm volatile("mov %0,%%cr4" : : "r"(cr4) : "memory");
+}
+
 // Halt the processor.
 // External interrupts wake up the CPU, hence the cli instruction.
 static inline void halt() {
@@ -0,0 +1,208 @@
+// Host stress test of the buddy frame allocator of kernel/mem/frame.c.
+// Build and run with "make framecheck" from the top directory.
+//
+// The physical memory is emulated by mapping RAM_START..RAM_END at the same address in the
+// process, so that the allocator can access the frames it hands out (and its frames array).
+
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+// Rename the YoctOS functions so that they do not clash with the C library
+#define memset    y_memset
+#define memsetdw  y_memsetdw
+#define memcpy    y_memcpy
+#define memcpydw  y_memcpydw
+#define memmove   y_memmove
+#define memcmp    y_memcmp
+#include "../common/mem.c"
+#include "../kernel/mem/frame.c"
+#undef memset
+#undef memsetdw
+#undef memcpy
+#undef memcpydw
+#undef memmove
+#undef memcmp
+
+// Frames below RAM_START stand for the kernel and the modules: they are never allocated
+#define RAM_START  0x10000000
+#define RAM_END    0x14000000
+
+// Framebuffer located in RAM, on purpose not aligned on a 4MB block
+#define FB_ADDR    0x12100000
+#define FB_PITCH   2048
+#define FB_HEIGHT  768
+
+#define SLOTS       1000
+#define ITERATIONS  200000
+
+// Stubs of the boot functions used by frame_init
+static multiboot_info_t mbi;
+
+multiboot_info_t *multiboot_get_info() {
+    return &mbi;
+}
+
+uint32_t modules_last_address() {
+    return RAM_START - 1;
+}
+
+// Allocations in progress. Every frame of a slot is filled with its index, so that a frame
+// handed out twice is detected when its first owner releases it.
+typedef struct {
+    uint32_t addr;  // 0 if the slot is free
+    uint_t count;   // number of frames
+    int order;      // order of a frame_alloc_block allocation, -1 if the frames are freed one by one
+    bool shared;    // single frame referenced twice (see frame_ref)
+} slot_t;
+
+static slot_t slots[SLOTS];
+
+static void fail(char *msg, uint32_t addr) {
+    printf("FAILED: %s (address 0x%x)\n", msg, addr);
+    exit(1);
+}
+
+static void check_alloc(slot_t *s, uint_t index) {
+    uint32_t addr = s->addr;
+    uint32_t end = addr + s->count * FRAME_SIZE;
+    if (addr % FRAME_SIZE)
+        fail("frame not aligned", addr);
+    if (s->order >= 0 && (addr / FRAME_SIZE) % (1u << s->order))
+        fail("block not aligned on its size", addr);
+    if (addr < RAM_START || end > RAM_END)
+        fail("frame outside of the free RAM", addr);
+    if (addr < FB_ADDR + FB_PITCH * FB_HEIGHT && end > FB_ADDR)
+        fail("frame inside the framebuffer", addr);
+    uint32_t *p = (uint32_t *)(uintptr_t)addr;
+    for (uint_t i = 0; i < s->count * FRAME_SIZE / 4; i++) {
+        if (p[i])
+            fail("frame not zeroed", addr);
+    }
+    for (uint_t i = 0; i < s->count * FRAME_SIZE / 4; i++)
+        p[i] = index + 1;
+}
+
+static void check_free(slot_t *s, uint_t index) {
+    uint32_t *p = (uint32_t *)(uintptr_t)s->addr;
+    for (uint_t i = 0; i < s->count * FRAME_SIZE / 4; i++) {
+        if (p[i] != index + 1)
+            fail("frame allocated twice", s->addr);
+    }
+    // Dirty the frames, so that a frame allocated without being zeroed is detected
+    memset(p, 0xA5, s->count * FRAME_SIZE);
+}
+
+static void release(slot_t *s, uint_t index) {
+    check_free(s, index);
+    if (s->order >= 0) {
+        frame_free_block((void *)(uintptr_t)s->addr, s->order);
+    } else {
+        for (uint_t i = 0; i < s->count; i++)
+            frame_free((void *)(uintptr_t)(s->addr + i * FRAME_SIZE));
+    }
+    s->addr = 0;
+}
+
+static void allocate(slot_t *s, uint_t index) {
+    void *addr;
+    s->shared = false;
+    switch (rand() % 4) {
+        case 0:
+            s->order = -1;
+            s->count = 1;
+            addr = frame_alloc();
+            break;
+        case 1:
+            s->order = rand() % (FRAME_MAX_ORDER + 1);
+            s->count = 1 << s->order;
+            addr = frame_alloc_block(s->order);
+            break;
+        case 2:
+            s->order = -1;
+            s->count = 1 + rand() % 100;
+            addr = frame_alloc_contiguous(s->count);
+            break;
+        default:
+            s->order = -1;
+            s->count = 1;
+            s->shared = true;
+            addr = frame_alloc();
+            break;
+    }
+    if (addr == (void *)0xFFFFFFFF)
+        return;
+    s->addr = (uint32_t)(uintptr_t)addr;
+    check_alloc(s, index);
+    if (s->shared) {
+        // The frame must survive the release of its first reference
+        frame_ref(addr);
+        if (frame_refcount(addr) != 2)
+            fail("wrong reference count", s->addr);
+        frame_free(addr);
+        if (frame_refcount(addr) != 1)
+            fail("frame freed while still referenced", s->addr);
+    }
+}
+
+int main() {
+    if (mmap((void *)RAM_START, RAM_END - RAM_START, PROT_READ | PROT_WRITE,
+             MAP_FIXED | MAP_PRIVATE | MAP_ANONYMOUS, -1, 0) != (void *)RAM_START) {
+        perror("mmap");
+        return 1;
+    }
+    // Frames are only zeroed by the allocator: start with dirty RAM
+    memset((void *)RAM_START, 0xA5, RAM_END - RAM_START);
+
+    mbi.framebuffer_addr = FB_ADDR;
+    mbi.framebuffer_pitch = FB_PITCH;
+    mbi.framebuffer_height = FB_HEIGHT;
+    frame_init(RAM_END / 1024);
+
+    stats_frames_t initial, st;
+    frame_stats(&initial);
+    printf("frames: %u total, %u free, largest free block of order %u\n",
+           initial.total, initial.free, initial.largest_free_order);
+
+    srand(1);
+    uint_t allocs = 0, failures = 0;
+    for (uint_t i = 0; i < ITERATIONS; i++) {
+        uint_t index = rand() % SLOTS;
+        slot_t *s = &slots[index];
+        if (s->addr) {
+            release(s, index);
+        } else {
+            allocate(s, index);
+            if (s->addr)
+                allocs++;
+            else
+                failures++;
+        }
+        // Fills the pool like the idle loop does
+        if (rand() % 8 == 0)
+            frame_pool_refill();
+    }
+    for (uint_t index = 0; index < SLOTS; index++) {
+        if (slots[index].addr)
+            release(&slots[index], index);
+    }
+    printf("%u allocations, %u failed for lack of a block\n", allocs, failures);
+
+    // Once every frame is freed (and the pool is given back), the blocks must all have been
+    // merged again: the free lists are the same as right after frame_init
+    pool_drain();
+    frame_stats(&st);
+    if (st.free != initial.free)
+        fail("free frames leaked", 0);
+    for (uint_t order = 0; order <= FRAME_MAX_ORDER; order++) {
+        if (st.free_blocks[order] != initial.free_blocks[order]) {
+            printf("FAILED: %u free blocks of order %u instead of %u\n", st.free_blocks[order],
+                   order, initial.free_blocks[order]);
+            return 1;
+        }
+    }
+    printf("results OK\n");
+    return 0;
+}
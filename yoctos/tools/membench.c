@@ -0,0 +1,167 @@
+// Host microbenchmark of the memory primitives of common/mem.c.
+// Build and run with "make membench" from the top directory.
+
+#define _POSIX_C_SOURCE 199309L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Rename the YoctOS functions so that they do not clash with the C library
+#define memset    y_memset
+#define memsetdw  y_memsetdw
+#define memcpy    y_memcpy
+#define memcpydw  y_memcpydw
+#define memmove   y_memmove
+#define memcmp    y_memcmp
+#include "../common/mem.c"
+#undef memset
+#undef memsetdw
+#undef memcpy
+#undef memcpydw
+#undef memmove
+#undef memcmp
+
+#define MAX_SIZE (4*1024*1024)
+#define BYTES_PER_RUN (64*1024*1024)  // bytes processed per measurement
+
+static uint8_t *buf_src;
+static uint8_t *buf_dst;
+static uint8_t *buf_ref;
+
+// Previous implementations (byte loops)
+static void byte_memset(void *dst, uint8_t value, uint_t count) {
+    volatile uint8_t *d = dst;
+    while (count--)
+        *d++ = value;
+}
+
+static void byte_memcpy(void *dst, void *src, uint_t count) {
+    volatile uint8_t *d = dst;
+    uint8_t *s = src;
+    while (count--)
+        *d++ = *s++;
+}
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+typedef void (*op_t)(uint_t size);
+static void op_byte_set(uint_t size) { byte_memset(buf_dst, 0x5a, size); }
+static void op_byte_cpy(uint_t size) { byte_memcpy(buf_dst, buf_src, size); }
+static void op_y_set(uint_t size)    { y_memset(buf_dst, 0x5a, size); }
+static void op_y_cpy(uint_t size)    { y_memcpy(buf_dst, buf_src, size); }
+static void op_libc_set(uint_t size) { memset(buf_dst, 0x5a, size); }
+static void op_libc_cpy(uint_t size) { memcpy(buf_dst, buf_src, size); }
+
+// Returns the throughput in MB/s.
+static double measure(op_t op, uint_t size) {
+    uint_t runs = BYTES_PER_RUN / size;
+    if (runs > 4000000)
+        runs = 4000000;
+    op(size);  // warm up
+    double start = now();
+    for (uint_t i = 0; i < runs; i++)
+        op(size);
+    double t = now() - start;
+    return (double)size * runs / t / (1024*1024);
+}
+
+// Compares the YoctOS functions with the C library on random sizes and alignments.
+static int check() {
+    int bad = 0;
+    srand(1);
+    for (int i = 0; i < 20000; i++) {
+        uint_t size = i % 100 ? rand() % 600 : rand() % (2*1024*1024);
+        uint_t doff = rand() % 64, soff = rand() % 64;
+        uint8_t value = rand();
+
+        for (uint_t j = 0; j < size + 128; j++)
+            buf_src[j] = rand();
+        memcpy(buf_dst, buf_src, size + 128);
+        memcpy(buf_ref, buf_src, size + 128);
+
+        switch (i % 6) {
+            case 0:
+                y_memset(buf_dst + doff, value, size);
+                memset(buf_ref + doff, value, size);
+                break;
+            case 1:
+                y_memcpy(buf_dst + doff, buf_src + soff + 64, size);
+                memcpy(buf_ref + doff, buf_src + soff + 64, size);
+                break;
+            case 2:  // overlapping, both directions
+                y_memmove(buf_dst + doff, buf_dst + soff, size);
+                memmove(buf_ref + doff, buf_ref + soff, size);
+                break;
+            case 3:
+                y_memsetdw(buf_dst + (doff & ~3), value * 0x01020304, size / 4);
+                for (uint_t j = 0; j < size / 4; j++)
+                    ((uint32_t *)(buf_ref + (doff & ~3)))[j] = value * 0x01020304;
+                break;
+            case 4:  // SSE2 versions called directly (e.g. by the kernel), any size
+                memcpy_sse2(buf_dst + doff, buf_src + soff + 64, size);
+                memcpy(buf_ref + doff, buf_src + soff + 64, size);
+                break;
+            case 5: {  // 16-bit pattern (framebuffer fill)
+                uint16_t pixel = value * 0x0103;
+                memfill_sse2(buf_dst + (doff & ~1), pixel * 0x00010001, size & ~1);
+                for (uint_t j = 0; j < size / 2; j++)
+                    ((uint16_t *)(buf_ref + (doff & ~1)))[j] = pixel;
+                break;
+            }
+        }
+        if (memcmp(buf_dst, buf_ref, size + 128) != 0) {
+            printf("mismatch: op=%d size=%u doff=%u soff=%u\n", i % 6, size, doff, soff);
+            bad++;
+        }
+        int r1 = y_memcmp(buf_dst, buf_src, size + 128), r2 = memcmp(buf_dst, buf_src, size + 128);
+        if ((r1 < 0) != (r2 < 0) || (r1 > 0) != (r2 > 0)) {
+            printf("memcmp mismatch: size=%u\n", size);
+            bad++;
+        }
+    }
+    return bad;
+}
+
+int main() {
+    buf_src = aligned_alloc(64, MAX_SIZE + 256);
+    buf_dst = aligned_alloc(64, MAX_SIZE + 256);
+    buf_ref = aligned_alloc(64, MAX_SIZE + 256);
+    memset(buf_src, 1, MAX_SIZE + 256);
+    memset(buf_dst, 2, MAX_SIZE + 256);
+
+    for (int sse2 = 0; sse2 <= 1; sse2++) {
+        mem_init(sse2);
+        int bad = check();
+        printf("%s: %s\n", sse2 ? "sse2" : "rep", bad ? "FAILED" : "results OK");
+        if (bad)
+            return 1;
+    }
+
+    printf("\nThroughput in MB/s\n");
+    printf("%8s | %8s %8s %8s %8s | %8s %8s %8s %8s\n", "size", "set byte", "set rep", "set sse2", "set libc",
+           "cpy byte", "cpy rep", "cpy sse2", "cpy libc");
+    // Powers of 2, so that the sizes on both sides of the non-temporal threshold (2MB) are measured
+    for (uint_t size = 8; size <= MAX_SIZE; size *= 2) {
+        double r[8];
+        r[0] = measure(op_byte_set, size);
+        mem_init(false);
+        r[1] = measure(op_y_set, size);
+        mem_init(true);
+        r[2] = measure(op_y_set, size);
+        r[3] = measure(op_libc_set, size);
+        r[4] = measure(op_byte_cpy, size);
+        mem_init(false);
+        r[5] = measure(op_y_cpy, size);
+        mem_init(true);
+        r[6] = measure(op_y_cpy, size);
+        r[7] = measure(op_libc_cpy, size);
+        printf("%8u | %8.0f %8.0f %8.0f %8.0f | %8.0f %8.0f %8.0f %8.0f\n", size,
+               r[0], r[1], r[2], r[3], r[4], r[5], r[6], r[7]);
+    }
+    return 0;
+}
@@ -1,12 +1,16 @@
 extern main
-
-global exit
+extern ulibc_init
+extern __ro_end
+extern exit
 
 section .entrypoint
-    call  main
-    jmp   exit
+    jmp   short start
+    align 4,db 0
+; Application header (see common/app.h)
+    dd    0x50504159  ; APP_MAGIC
+    dd    __ro_end    ; end of the code and read-only data (see app.ld)
 
-section .text
-
-exit:
-    iret
+start:
+    call  ulibc_init
+    call  main
+    call  exit  ; never returns
@@ -0,0 +1,43 @@
+#include "ulibc.h"
+#include "common/kbench.h"
+
+// Kernel micro-benchmarks. Results are expressed in CPU cycles.
+// Think of compiling YoctOS with "make clean && make run DEBUG=0" for meaningful results.
+
+void main() {
+	int count = 100000;
+	kbench_switch_t sw;
+
+	if (kbench(KBENCH_TASK_SWITCH, count, &sw) == 0) {
+		printf("Task switch (%d iterations):\n", count);
+		printf("  hardware (TSS)    : %d cycles\n", sw.hw_switch);
+		printf("  software          : %d cycles\n", sw.sw_switch);
+		printf("  software + CR3    : %d cycles\n", sw.sw_switch_cr3);
+	}
+
+	kbench_load_t load = { .name = "shell.exe" };
+	count = 1000;
+	if (kbench(KBENCH_TASK_LOAD, count, &load) == 0) {
+		printf("Task load + free of %s (%d iterations, %d pages shared):\n", load.name, count, load.shared_pages);
+		printf("  module mapped     : %d cycles\n", load.map);
+		printf("  module copied     : %d cycles\n", load.copy);
+	}
+
+	kbench_frames_t frames;
+	count = 100000;
+	if (kbench(KBENCH_FRAMES, count, &frames) == 0) {
+		printf("Frame allocator (%d iterations, zeroing included):\n", count);
+		printf("  single frame      : %d cycles per alloc+free\n", frames.single);
+		printf("  1-16 frame blocks : %d cycles per alloc+free (%d failures, largest free block %dKB)\n",
+		       frames.mixed, frames.failures, 4 << frames.largest_free_order);
+	}
+
+	kbench_cow_t cow;
+	count = 256;
+	if (kbench(KBENCH_COW, count, &cow) == 0) {
+		printf("Copy-on-write (%d pages, %s):\n", count, cow.errors ? "FAILED" : "checked");
+		printf("  share             : %d cycles per page\n", cow.share);
+		printf("  write (copy)      : %d cycles per page\n", cow.copy);
+		printf("  write (last ref)  : %d cycles per page\n", cow.reuse);
+	}
+}
@@ -0,0 +1,16 @@
+#include "ulibc.h"
+
+// Terminal throughput: prints many lines (the screen scrolls on every line).
+
+#define LINE_COUNT 2000
+
+void main() {
+	uint64_t start = get_time_us();
+	for (int i = 0; i < LINE_COUNT; i++) {
+		printf("Line %d: the quick brown fox jumps over the lazy dog\n", i);
+	}
+	uint_t us = get_time_us() - start;
+	if (us == 0)
+		us = 1;
+	printf("%d lines printed in %d ms (%d lines/s)\n", LINE_COUNT, us / 1000, (uint_t)((uint64_t)LINE_COUNT * 1000000 / us));
+}
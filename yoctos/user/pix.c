@@ -1,9 +1,33 @@
 #include "ulibc.h"
+#include "syscall.h"
 #include "common/vbe_fb.h"
+#include "common/syscall_nb.h"
+#include "common/cpu.h"
+#include "common/sysring.h"
+#include "common/mem.h"
 
 // For this performance measurment to be meaningful, think of compiling YoctOS
 // with "make clean && make run DEBUG=0" which uses compiler optimizations!
 
+// Returns the average number of cycles of a setpixel syscall issued with func.
+static uint32_t syscall_cycles(syscall_func_t func, int count) {
+	uint64_t start = rdtsc();
+	for (int i = 0; i < count; i++) {
+		func(SYSCALL_VBE_SETPIX, 0, 0, 0x0, 0);
+	}
+	return (rdtsc() - start) / count;
+}
+
+// Same as syscall_cycles but the syscalls are batched through the syscall ring.
+static uint32_t sysring_cycles(int count) {
+	uint64_t start = rdtsc();
+	for (int i = 0; i < count; i++) {
+		sysring_queue(SYSCALL_VBE_SETPIX, 0, 0, 0x0, 0, SYSRING_F_NOCQE, 0);
+	}
+	sysring_submit();
+	return (rdtsc() - start) / count;
+}
+
 void main() {
 	uint_t width, height;
 	vbe_init(&width, &height);
@@ -40,4 +64,67 @@ void main() {
 
 	printf("Without syscalls: %d ticks\n", end_1 - start_1);
 	printf("With syscalls: %d ticks\n", end_2 - start_2);
+
+	int nb_calls = 100000;
+	printf("int 48: %d cycles/syscall\n", syscall_cycles(syscall_int48, nb_calls));
+	if (syscall == syscall_sysenter) {
+		printf("sysenter: %d cycles/syscall\n", syscall_cycles(syscall_sysenter, nb_calls));
+	} else {
+		printf("sysenter: not supported\n");
+	}
+	printf("ring (%d per trap): %d cycles/syscall\n", SYSRING_ENTRIES, sysring_cycles(nb_calls));
+
+	// Clear the screen nb_loops times with a single rectangle fill syscall per clear
+	uint_t start_3 = get_ticks();
+	for (int x = 0; x < nb_loops; x++) {
+		vbe_fill_rect(0, 0, width, height, 0x0);
+	}
+	uint_t end_3 = get_ticks();
+	printf("With fill_rect syscall: %d ticks\n", end_3 - start_3);
+
+	// TLB cost of the framebuffer mapping: one store per 4KB page touches more pages than the
+	// TLB holds, unless the framebuffer is mapped with 4MB pages (see paging_mmap)
+	vbe_fb_t info;
+	syscall(SYSCALL_VBE_FB_INFO, (uint32_t)&info, 0, 0, 0);
+	uint_t fb_pages = info.size / 4096;
+	volatile uint16_t *fb_pix = info.addr;
+	uint64_t start_tlb = rdtsc();
+	for (int x = 0; x < nb_loops; x++) {
+		for (uint_t p = 0; p < fb_pages; p++) {
+			fb_pix[p * 2048] = 0x0;
+		}
+	}
+	printf("Framebuffer page touch (%d pages): %d cycles/page\n", fb_pages,
+	       (uint32_t)((rdtsc() - start_tlb) / (nb_loops * fb_pages)));
+	start_tlb = rdtsc();
+	for (int x = 0; x < nb_loops; x++) {
+		memsetdw(info.addr, 0, info.size / 4);
+	}
+	uint32_t fill_cycles = (rdtsc() - start_tlb) / nb_loops;
+	printf("Framebuffer fill with memsetdw: %d cycles/fill (%d cycles/page)\n", fill_cycles, fill_cycles / fb_pages);
+
+	// Scroll the whole screen by one row nb_loops times
+	uint_t start_4 = get_ticks();
+	for (int x = 0; x < nb_loops; x++) {
+		vbe_copy_rect(0, 0, 0, 1, width, height - 1);
+	}
+	uint_t end_4 = get_ticks();
+	printf("Scrolling with copy_rect syscall: %d ticks\n", end_4 - start_4);
+
+	// Same per-pixel (column-major) clear as the first one, but into the back buffer
+	// in RAM, which is then copied to the framebuffer by a single flush
+	if (vbe_init_buffered(&width, &height)) {
+		uint_t start_5 = get_ticks();
+		for (int x = 0; x < nb_loops; x++) {
+			for (uint_t i = 0; i < width; i++) {
+				for (uint_t j = 0; j < height; j++) {
+					vbe_setpixel(i, j, 0x0);
+				}
+			}
+			vbe_flush(0, 0, width, height);
+		}
+		uint_t end_5 = get_ticks();
+		printf("Without syscalls, back buffer + flush: %d ticks\n", end_5 - start_5);
+		vbe_init(&width, &height);
+	}
 }
@@ -1,11 +1,14 @@
 #include "ulibc.h"
+#include "common/stats.h"
 
 static void help() {
     char msg[] = "\n\
 PROG      : execute program PROG\n\
+PROG &    : execute program PROG in the background\n\
 exit      : exit this shell\n\
 help      : display this help\n\
 sleep N   : sleep N milliseconds (preemptive)\n\
+stats     : show kernel statistics\n\
 ticks     : show the current ticks value and timer frequency\n";
     puts(msg);
 }
@@ -17,7 +20,7 @@ static void run() {
 
     while (1) {
         puts(">");
-        read_string(buf);
+        read_string(buf, sizeof(buf));
         char *line = tolower(trim(buf));  // removes heading and trailing spaces and convert to lower case
         if (line[0] == 0) {
             putc('\n');
@@ -38,16 +41,72 @@ static void run() {
             timer_info(&freq, &ticks);
             printf("ticks=%d freq=%d\n", ticks, freq);
         }
+        else if (strcmp("stats", line) == 0) {
+            putc('\n');
+            stats_timer_t st;
+            if (stats(STATS_TIMER, &st) == 0) {
+                printf("timer: freq=%dHz ticks=%d idle=%d pending=%d\n", st.freq, st.ticks, st.idle_ticks, st.pending_timers);
+                printf("sleep: count=%d jitter avg=%d max=%d ticks\n", st.sleeps,
+                       st.sleeps ? st.jitter_total / st.sleeps : 0, st.jitter_max);
+            }
+            stats_term_t term;
+            if (stats(STATS_TERM, &term) == 0) {
+                uint_t lookups = term.glyph_hits + term.glyph_misses;
+                printf("glyph cache: hits=%d misses=%d (hit rate %d%%) evictions=%d capacity=%d\n",
+                       term.glyph_hits, term.glyph_misses, lookups ? (uint_t)((uint64_t)term.glyph_hits * 100 / lookups) : 0,
+                       term.glyph_evictions, term.glyph_capacity);
+            }
+            stats_fpu_t fpu;
+            if (stats(STATS_FPU, &fpu) == 0 && fpu.enabled)
+                printf("fpu: task switches=%d fpu switches=%d\n", fpu.task_switches, fpu.fpu_switches);
+            stats_frames_t frames;
+            if (stats(STATS_FRAMES, &frames) == 0) {
+                printf("frames: free=%d/%d largest free block=%dKB, free blocks per order:", frames.free, frames.total,
+                       (4 << frames.largest_free_order));
+                for (uint_t i = 0; i <= STATS_FRAME_MAX_ORDER; i++)
+                    printf(" %d", frames.free_blocks[i]);
+                putc('\n');
+                printf("zeroed frame pool: %d frames, hits=%d misses=%d\n", frames.pool_frames,
+                       frames.pool_hits, frames.pool_misses);
+            }
+            stats_kmalloc_t heap;
+            if (stats(STATS_KMALLOC, &heap) == 0) {
+                printf("kmalloc: size/in use/slabs:");
+                for (uint_t i = 0; i < STATS_KMALLOC_CLASSES; i++)
+                    printf(" %d/%d/%d", heap.classes[i].size, heap.classes[i].in_use, heap.classes[i].slabs);
+                printf(", large=%d (%dKB), failures=%d\n", heap.large_in_use, heap.large_frames*4, heap.failures);
+            }
+            stats_tasks_t tasks;
+            if (stats(STATS_TASKS, &tasks) == 0) {
+                for (uint_t i = 0; i < tasks.count; i++)
+                    printf("task %d: reserved=%dKB resident=%dKB shared=%dKB page faults=%d kernel stack=%d bytes\n",
+                           tasks.tasks[i].id, tasks.tasks[i].reserved, tasks.tasks[i].resident, tasks.tasks[i].shared,
+                           tasks.tasks[i].page_faults, tasks.tasks[i].kstack_used);
+                if (tasks.total > tasks.count)
+                    printf("(%d more task(s) not shown)\n", tasks.total - tasks.count);
+            }
+        }
         else if (strcmp("exit", line) == 0) {
             puts("\nBye.\n");
             exit();
         }
+        // Attempts to run the specified file in the background
+        else if (line[strlen(line)-1] == '&') {
+            putc('\n');
+            line[strlen(line)-1] = 0;
+            line = trim(line);
+            int id = task_spawn(line, 0, NULL);
+            if (id < 0) {
+                printf("Failed executing \"%s\"\n", line);
+            } else {
+                printf("[%d] %s\n", id, line);
+            }
+        }
         // Attempts to run the specified file
         else {
             putc('\n');
             // get args in mem
-            int id = task_exec(line, 0, NULL);
-            if (id == -1) {
+            if (!task_exec(line, 0, NULL)) {
                 printf("Failed executing \"%s\"\n", line);
             }
         }
@@ -0,0 +1,19 @@
+#include "ulibc.h"
+
+// Exec latency: runs a small application many times in a row, as the shell does.
+// See also the task load benchmark of kbench.exe, which compares mapping and copying the module.
+
+#define SPAWN_COUNT 100
+#define SPAWN_APP "test.exe"
+
+void main() {
+	uint64_t start = get_time_us();
+	for (int i = 0; i < SPAWN_COUNT; i++) {
+		if (!task_exec(SPAWN_APP, 0, NULL)) {
+			printf("Failed executing \"%s\"\n", SPAWN_APP);
+			return;
+		}
+	}
+	uint_t us = get_time_us() - start;
+	printf("%d executions of %s in %d ms (%d us per exec)\n", SPAWN_COUNT, SPAWN_APP, us / 1000, us / SPAWN_COUNT);
+}
@@ -3,6 +3,13 @@
 
 #include "common/types.h"
 
-extern int syscall(uint_t nb, uint32_t arg1, uint32_t arg2, uint32_t arg3, uint32_t arg4);
+typedef int (*syscall_func_t)(uint_t nb, uint32_t arg1, uint32_t arg2, uint32_t arg3, uint32_t arg4);
+
+// Issues a system call using the fastest entry supported by the CPU (see ulibc_init).
+extern syscall_func_t syscall;
+
+// Implemented in syscall_asm.s
+extern int syscall_int48(uint_t nb, uint32_t arg1, uint32_t arg2, uint32_t arg3, uint32_t arg4);
+extern int syscall_sysenter(uint_t nb, uint32_t arg1, uint32_t arg2, uint32_t arg3, uint32_t arg4);
 
 #endif
@@ -1,10 +1,11 @@
-global syscall
+global syscall_int48
+global syscall_sysenter
 
 section .text                      ; start of the text (code) section
 align 4                            ; the code must be 4 byte aligned
 
-; int syscall(uint32_t nb, uint32_t arg1, uint32_t arg2, uint32_t arg3, uint32_t arg4);
-syscall:
+; int syscall_int48(uint32_t nb, uint32_t arg1, uint32_t arg2, uint32_t arg3, uint32_t arg4);
+syscall_int48:
     ; parameters cannot be passed into the stack because the trap/interrupt gate
     ; performs a stack switch (from user stack to kernel stack). By the time we're
     ; in the syscall handler we're accessing the kernel stack (tss.ss/tss.esp).
@@ -38,3 +39,30 @@ syscall:
     mov     esp,ebp
     pop     ebp
     ret
+
+; Fast system call using the sysenter instruction (see the kernel's _sysenter_handler).
+; sysexit returns to the address in edx with the stack pointer in ecx, hence the
+; arguments are passed in ebx, edi, ebp and esi.
+;
+; int syscall_sysenter(uint32_t nb, uint32_t arg1, uint32_t arg2, uint32_t arg3, uint32_t arg4);
+syscall_sysenter:
+    push    ebp
+    push    ebx
+    push    esi
+    push    edi
+
+    mov     eax,[esp+20]
+    mov     ebx,[esp+24]
+    mov     edi,[esp+28]
+    mov     ebp,[esp+32]
+    mov     esi,[esp+36]
+    mov     ecx,esp
+    mov     edx,.return
+    sysenter
+
+.return:
+    pop     edi
+    pop     esi
+    pop     ebx
+    pop     ebp
+    ret
@@ -1,24 +1,48 @@
 #include "common/string.h"
 #include "common/stdio.h"
+#include "common/mem.h"
 #include "common/vbe_fb.h"
+#include "common/syscall_nb.h"
+#include "common/cpu.h"
+#include "common/sysring.h"
+#include "common/vdso.h"
 #include "ulibc.h"
 #include "syscall.h"
 #include "ld.h"
 
-#define TAB_SIZE  4
-
 #define BUFFER_SIZE 1024
 
 SECTION_DATA static vbe_fb_t fb;
 
+SECTION_DATA syscall_func_t syscall = syscall_int48;
+
+// End of the bss (see app.ld)
+extern char __end[];
+
+// Called by the entry point before main.
+void ulibc_init() {
+    if (cpu_has_sysenter())
+        syscall = syscall_sysenter;
+    // The bss is not part of the binary: the heap is grown over it before anything uses it
+    char *brk = sbrk(0);
+    if (__end > brk)
+        sbrk(__end - brk);
+    // SSE2 memory functions, if the kernel saves the SSE registers of tasks
+    mem_init(cpu_has_sse2() && (((vdso_t *)VDSO_ADDR)->features & VDSO_FEATURE_SSE));
+}
+
+void exit() {
+	syscall(SYSCALL_TASK_EXIT, 0, 0, 0, 0);
+}
+
 int get_mod_size(char *filename) {
     int size;
-    syscall(9, filename, &size, 0, 0);
+    syscall(SYSCALL_MOD_SIZE, (uint32_t)filename, (uint32_t)&size, 0, 0);
     return size;
 }
 
 void get_task_addr_by_id(int id, void* addr) {
-    syscall(10, id, &addr, 0, 0);
+    syscall(SYSCALL_TASK_ADDR_BY_ID, id, &addr, 0, 0);
     return addr;
 }
 
@@ -35,27 +59,31 @@ char *get_args (int i) {
 void sleep(uint_t ms) {
     // TODO
     // Call syscall for sleep
-	syscall(4, ms, 0, 0, 0);
+	syscall(SYSCALL_TIMER_SLEEP, ms, 0, 0, 0);
 }
 
 int getc() {
     int c;
     // TODO
     // Call syscall for keyb_get_key()
-	syscall(2, &c, 0, 0, 0);
+	syscall(SYSCALL_KEYB_GET_KEY, (uint32_t)&c, 0, 0, 0);
     return c;
 }
 
+int read_keys(int *keys, uint_t count) {
+    return syscall(SYSCALL_KEYB_READ, (uint32_t)keys, count, KEYB_READ_RAW, 0);
+}
+
 void putc(char c) {
 	// TODO
 	// Call syscall for term_putc()
-	syscall(8, c, 0, 0, 0);
+	syscall(SYSCALL_PUTC, c, 0, 0, 0);
 }
 
 void puts(char *str) {
 	// TODO
 	// Call syscall for term_puts()
-	syscall(0, str, 0,0,0);
+	syscall(SYSCALL_TERM_PUTS, (uint32_t)str, 0, 0, 0);
 }
 
 void printf(char *fmt, ...) {
@@ -70,31 +98,88 @@ void printf(char *fmt, ...) {
 void set_colors(term_colors_t cols) {
 	// TODO
 	// Call syscall for term_set_colors()
-	syscall(1, cols.fg, cols.bg, 0, 0);
+	syscall(SYSCALL_TERM_SET_COLORS, cols.fg, cols.bg, 0, 0);
 }
 
 bool task_exec(char *filename, int argc, char **argv) {
 	// TODO
 	// Call syscall for task_exec()
-	syscall(7, filename, argc, argv, 0);
+	return syscall(SYSCALL_TASK_EXEC, (uint32_t)filename, argc, (uint32_t)argv, 0) == 0;
+}
+
+int task_spawn(char *filename, int argc, char **argv) {
+	return syscall(SYSCALL_TASK_SPAWN, (uint32_t)filename, argc, (uint32_t)argv, 0);
+}
+
+static vdso_t *vdso = (vdso_t *)VDSO_ADDR;
+
+// Copies the timer page consistently (seqlock reader).
+static void vdso_read(vdso_t *copy) {
+	uint32_t seq;
+	do {
+		seq = vdso->seq;
+		asm volatile("" : : : "memory");
+		copy->ticks = vdso->ticks;
+		copy->freq = vdso->freq;
+		copy->tsc = vdso->tsc;
+		copy->tsc_khz = vdso->tsc_khz;
+		asm volatile("" : : : "memory");
+	} while ((seq & 1) || seq != vdso->seq);
 }
 
 void timer_info(uint_t *freq, uint_t *ticks) {
-	// TODO
-	// Call syscall for timer_info()
-	syscall(3, (uint32_t)freq, (uint32_t)ticks, 0, 0);
+	// Reads the timer page instead of issuing a syscall
+	vdso_t v;
+	vdso_read(&v);
+	if (freq)
+		*freq = v.freq;
+	if (ticks)
+		*ticks = v.ticks;
+}
+
+uint64_t get_time_us() {
+	vdso_t v;
+	uint64_t tsc;
+	// The TSC must be read within the same tick as the snapshot
+	do {
+		vdso_read(&v);
+		tsc = rdtsc();
+	} while (v.ticks != vdso->ticks);
+	uint64_t us = (uint64_t)v.ticks * 1000000 / v.freq;
+	if (v.tsc_khz)
+		us += (tsc - v.tsc) * 1000 / v.tsc_khz;
+	return us;
+}
+
+uint_t get_tsc_khz() {
+	return vdso->tsc_khz;
 }
 
 void vbe_init(uint_t *width, uint_t *height){
 	// TODO
 	// Call syscall for vbe_fb_info()
-	syscall(5, (vbe_fb_t*)&fb, 0, 0, 0);
+	syscall(SYSCALL_VBE_FB_INFO, (uint32_t)&fb, 0, 0, 0);
+	*width = fb.width;
+	*height = fb.height;
+}
+
+bool vbe_init_buffered(uint_t *width, uint_t *height) {
+	if (syscall(SYSCALL_VBE_FB_INFO, (uint32_t)&fb, true, 0, 0) < 0) {
+		vbe_init(width, height);
+		return false;
+	}
 	*width = fb.width;
 	*height = fb.height;
+	return true;
+}
+
+void vbe_flush(int x, int y, int w, int h) {
+	vbe_rect_t r = { x, y, w, h };
+	syscall(SYSCALL_VBE_FLUSH, (uint32_t)&r, 0, 0, 0);
 }
 
 void vbe_setpixel_syscall(int x, int y, uint16_t color) {
-	syscall(6, x, y, color, 0);
+	syscall(SYSCALL_VBE_SETPIX, x, y, color, 0);
 }
 
 void vbe_setpixel(int x, int y, uint16_t color) {
@@ -102,46 +187,179 @@ void vbe_setpixel(int x, int y, uint16_t color) {
 	*pixel = color;
 }
 
+int kbench(uint_t id, uint_t count, void *results) {
+	return syscall(SYSCALL_KBENCH, id, count, (uint32_t)results, 0);
+}
+
+int stats(uint_t id, void *results) {
+	return syscall(SYSCALL_STATS, id, (uint32_t)results, 0, 0);
+}
+
+static sysring_t *ring = (sysring_t *)SYSRING_ADDR;
+
+bool sysring_queue(uint_t nb, uint32_t arg1, uint32_t arg2, uint32_t arg3, uint32_t arg4, uint_t flags, uint32_t user_data) {
+	if (ring->sq_tail - ring->sq_head >= SYSRING_ENTRIES) {
+		sysring_submit();
+		// The kernel stops when the completion queue is full: nothing may have been executed
+		if (ring->sq_tail - ring->sq_head >= SYSRING_ENTRIES)
+			return false;
+	}
+	sysring_sqe_t *sqe = &ring->sq[ring->sq_tail & SYSRING_MASK];
+	sqe->nb = nb;
+	sqe->flags = flags;
+	sqe->args[0] = arg1;
+	sqe->args[1] = arg2;
+	sqe->args[2] = arg3;
+	sqe->args[3] = arg4;
+	sqe->user_data = user_data;
+	ring->sq_tail++;
+	return true;
+}
+
+int sysring_submit() {
+	if (ring->sq_head == ring->sq_tail)
+		return 0;
+	return syscall(SYSCALL_SYSRING_ENTER, 0, 0, 0, 0);
+}
+
+bool sysring_complete(uint32_t *user_data, int *result) {
+	if (ring->cq_head == ring->cq_tail)
+		return false;
+	sysring_cqe_t *cqe = &ring->cq[ring->cq_head & SYSRING_MASK];
+	*user_data = cqe->user_data;
+	*result = cqe->result;
+	ring->cq_head++;
+	return true;
+}
+
+void vbe_fill_rect(int x, int y, int w, int h, uint16_t color) {
+	vbe_rect_t r = { x, y, w, h };
+	syscall(SYSCALL_VBE_FILL_RECT, (uint32_t)&r, color, 0, 0);
+}
+
+void vbe_blit(int x, int y, int w, int h, uint16_t *src, uint_t src_pitch_in_pix) {
+	vbe_rect_t r = { x, y, w, h };
+	syscall(SYSCALL_VBE_BLIT, (uint32_t)&r, (uint32_t)src, src_pitch_in_pix, 0);
+}
+
+void vbe_copy_rect(int dst_x, int dst_y, int src_x, int src_y, int w, int h) {
+	vbe_rect_t r = { dst_x, dst_y, w, h };
+	syscall(SYSCALL_VBE_COPY_RECT, (uint32_t)&r, src_x, src_y, 0);
+}
+
 uint_t get_ticks() {
-	uint_t ticks;
-	timer_info(0, &ticks);
-	return ticks;
+	return vdso->ticks;
 }
 // TODO: implement other syscall wrappers...
 
-void read_string(char *buf) {
-    char *start = buf;
-    for (;;) {
-        int c = getc();
-        if (c) {
-            // backspace
-            if (c == '\b') {
-                if (buf - start > 0) {
-                    putc(c);
-                    buf--;
-                }
-            }
-            // return
-            else if (c == '\n') {
-                break;
-            }
-            // tab
-            else if (c == '\t') {
-                c = ' ';
-                for (int i = 0; i < TAB_SIZE; i++) {
-                    putc(c);
-                    *buf = c;
-                    buf++;
-                }
-            }
-            else {
-                putc(c);
-                *buf = c;
-                buf++;
-            }
-        }
-    }
-    *buf = 0;
+void *sbrk(int increment) {
+	return (void *)syscall(SYSCALL_SBRK, (uint32_t)increment, 0, 0, 0);
+}
+
+// Heap: blocks of power-of-two size classes (header included), recycled through one free list
+// per class. Larger blocks are multiples of 4KB, recycled through a single first-fit list.
+// New blocks are carved out of the arena, which is grown with sbrk HEAP_CHUNK bytes at a time.
+// Tasks are single-threaded: the free lists act as a per-thread cache without any locking.
+
+#define HEAP_CHUNK      (64*1024)
+#define HEAP_MAGIC      0x50414548  // "HEAP"
+#define HEAP_CLASSES    8           // 16 to 2048 bytes
+#define HEAP_MIN_BLOCK  16
+#define HEAP_MAX_BLOCK  (HEAP_MIN_BLOCK << (HEAP_CLASSES - 1))
+#define HEAP_PAGE       4096
+
+typedef struct heap_block_st {
+	uint32_t size;                // size of the block, header included
+	uint32_t magic;               // HEAP_MAGIC while allocated
+	struct heap_block_st *next;   // next free block of the list (only valid while free)
+} heap_block_t;
+
+// Size of the header preceding the memory returned by malloc: blocks start on 16 bytes,
+// hence the memory returned is only aligned on 8 bytes (enough for any scalar type)
+#define HEAP_HEADER  8
+
+// Largest size malloc accepts: adding the header and rounding it up to a page cannot wrap
+#define HEAP_MAX_SIZE  ((uint_t)-1 - HEAP_HEADER - HEAP_PAGE)
+
+SECTION_DATA static heap_block_t *heap_free[HEAP_CLASSES] = { NULL };
+SECTION_DATA static heap_block_t *heap_free_large = NULL;
+SECTION_DATA static uint8_t *arena_next = NULL;  // unused part of the arena: [arena_next, arena_end)
+SECTION_DATA static uint8_t *arena_end = NULL;
+
+// Returns a new block of size bytes from the arena, or NULL if the heap cannot grow anymore.
+static heap_block_t *arena_alloc(uint_t size) {
+	if ((uint_t)(arena_end - arena_next) < size) {
+		// Room is left for aligning the start of a new arena
+		uint_t grow = size + HEAP_MIN_BLOCK > HEAP_CHUNK ? size + HEAP_MIN_BLOCK : HEAP_CHUNK;
+		// sbrk takes a signed increment
+		if (grow > 0x7FFFFFFF)
+			return NULL;
+		uint8_t *old = sbrk(grow);
+		if (old == (uint8_t *)-1)
+			return NULL;
+		// The arena continues unless someone else moved the end of the heap meanwhile
+		if (old != arena_end)
+			arena_next = (uint8_t *)(((uint32_t)old + HEAP_MIN_BLOCK - 1) & ~(HEAP_MIN_BLOCK - 1));
+		arena_end = old + grow;
+	}
+	heap_block_t *b = (heap_block_t *)arena_next;
+	arena_next += size;
+	b->size = size;
+	return b;
+}
+
+void *malloc(uint_t size) {
+	if (size > HEAP_MAX_SIZE)
+		return NULL;
+	uint_t need = size + HEAP_HEADER;
+	heap_block_t *b = NULL;
+	if (need <= HEAP_MAX_BLOCK) {
+		uint_t cls = 0;
+		while ((uint_t)(HEAP_MIN_BLOCK << cls) < need)
+			cls++;
+		b = heap_free[cls];
+		if (b)
+			heap_free[cls] = b->next;
+		else
+			b = arena_alloc(HEAP_MIN_BLOCK << cls);
+	} else {
+		need = (need + HEAP_PAGE - 1) & ~(HEAP_PAGE - 1);
+		heap_block_t **prev = &heap_free_large;
+		while (*prev && (*prev)->size < need)
+			prev = &(*prev)->next;
+		b = *prev;
+		if (b)
+			*prev = b->next;
+		else
+			b = arena_alloc(need);
+	}
+	if (!b)
+		return NULL;
+	b->magic = HEAP_MAGIC;
+	return (uint8_t *)b + HEAP_HEADER;
+}
+
+void free(void *ptr) {
+	if (!ptr)
+		return;
+	heap_block_t *b = (heap_block_t *)((uint8_t *)ptr - HEAP_HEADER);
+	if (b->magic != HEAP_MAGIC)
+		return;  // not allocated by malloc, or already freed
+	b->magic = 0;
+	if (b->size <= HEAP_MAX_BLOCK) {
+		uint_t cls = 0;
+		while ((uint_t)(HEAP_MIN_BLOCK << cls) < b->size)
+			cls++;
+		b->next = heap_free[cls];
+		heap_free[cls] = b;
+	} else {
+		b->next = heap_free_large;
+		heap_free_large = b;
+	}
+}
+
+void read_string(char *buf, uint_t size) {
+    syscall(SYSCALL_KEYB_READ, (uint32_t)buf, size, KEYB_READ_LINE, 0);
 }
 
 // Return 1 if string str starts with prefix.
@@ -6,19 +6,40 @@
 #include "common/string.h"
 #include "common/vbe_fb.h"
 
+extern void ulibc_init();  // called by the entry point before main
+
 extern bool task_exec(char *filename, int argc, char **argv);
-extern void exit();  // defined in entrypoint_asm.s
+extern int task_spawn(char *filename, int argc, char **argv);  // returns the task id or -1
+extern void exit();  // terminates the task, never returns (also called once main returns)
 
 extern void timer_info(uint_t *freq, uint_t *ticks);
 extern uint_t get_ticks();
+extern uint64_t get_time_us();  // microseconds since boot (TSC interpolated)
+extern uint_t get_tsc_khz();    // TSC frequency in kHz (0 if unknown)
 extern void sleep(uint_t ms);
 
 extern void vbe_init(uint_t *width, uint_t *height);
+// Same as vbe_init, but vbe_setpixel then draws into a back buffer private to the task and
+// nothing is displayed until vbe_flush is called. Returns false if the back buffer could not be
+// allocated (vbe_setpixel then draws directly into the framebuffer).
+extern bool vbe_init_buffered(uint_t *width, uint_t *height);
+// Displays the rectangle of the back buffer.
+extern void vbe_flush(int x, int y, int w, int h);
 extern void vbe_setpixel(int x, int y, uint16_t color);
 extern void vbe_setpixel_syscall(int x, int y, uint16_t color);
+// Rectangle operations performed by the kernel (clipped to the screen)
+extern void vbe_fill_rect(int x, int y, int w, int h, uint16_t color);
+extern void vbe_blit(int x, int y, int w, int h, uint16_t *src, uint_t src_pitch_in_pix);
+extern void vbe_copy_rect(int dst_x, int dst_y, int src_x, int src_y, int w, int h);
 
-extern void read_string(char *buf);
+// Reads a line typed by the user into buf (size bytes, null terminator included), blocking
+// until enter is pressed. The line is edited and echoed by the kernel: one syscall per line.
+extern void read_string(char *buf, uint_t size);
+// Returns the key that was pressed or 0 if there is none (never blocks).
 extern int getc();
+// Stores up to count keys into keys, blocking until at least one is pressed.
+// Returns the number of keys stored.
+extern int read_keys(int *keys, uint_t count);
 
 extern int starts_with(char *prefix, char *str);
 extern char *trim(char *line);
@@ -32,4 +53,31 @@ extern int get_args_count ();
 extern char *get_args (int i);
 extern int get_mod_size(char *filename);
 extern void get_task_addr_by_id(int id, void *addr);
+
+// Runs kernel benchmark id (see common/kbench.h) and stores its results in results.
+extern int kbench(uint_t id, uint_t count, void *results);
+
+// Syscall ring (see common/sysring.h).
+// Queues a syscall (the queue is submitted first if full). Data pointed to by arguments
+// must remain valid until the entry is submitted.
+// The kernel stops executing entries when the completion queue is full: callers must reap
+// the completions (sysring_complete) of the entries that post one.
+// Returns false if the queue is full and submitting it made no room.
+extern bool sysring_queue(uint_t nb, uint32_t arg1, uint32_t arg2, uint32_t arg3, uint32_t arg4, uint_t flags, uint32_t user_data);
+// Executes the queued syscalls with a single trap. Returns the number of syscalls executed.
+extern int sysring_submit();
+// Retrieves the next completion. Returns false if there is none.
+extern bool sysring_complete(uint32_t *user_data, int *result);
+
+// Retrieves kernel statistics id (see common/stats.h) into results.
+extern int stats(uint_t id, void *results);
+
+// Moves the end of the heap by increment bytes (see task_sbrk in the kernel).
+// Returns the previous end of the heap or (void *)-1 if it could not be moved.
+extern void *sbrk(int increment);
+
+// Allocates size bytes on the heap, aligned on 8 bytes. Returns NULL if the heap is exhausted.
+extern void *malloc(uint_t size);
+// Frees memory returned by malloc. NULL is ignored.
+extern void free(void *ptr);
 #endif